@@ -2,6 +2,14 @@
 
 #include <array>
 #include <memory>
+#include <cstdint>
+#include <functional>
+
+namespace dnnl {
+namespace threadpool_interop {
+struct threadpool_iface;
+}
+}
 
 namespace boat {
 // copy from oneDNN
@@ -104,6 +112,7 @@ enum class BinaryDataLayout {
 };
 struct BinaryStaticParam {
     BinaryDataLayout layout;
+    int ld;         // PerElement only: bytes between two rows of the second param, 0 means ldc
 };
 
 struct PostOpStaticParam {
@@ -174,19 +183,213 @@ using JitParamArr = PostOpRuntimeParam[MAX_POSTOPS_NUM];
 struct PostOpRuntimeParams {
     COAT_NAME("PostOpRuntimeParams");
     #define MEMBERS(x)    \
-        x(JitParamArr, params)
+        x(JitParamArr, params) \
+        x(int*, c_row_index) \
+        x(float*, c_row_scale) \
+        x(float*, row_reduce_val) \
+        x(int*, row_reduce_idx) \
+        x(float*, norm_gamma) \
+        x(float*, norm_beta) \
+        x(float*, a_scale) \
+        x(float*, b_scale) \
+        x(int*, b_comp)
 
     COAT_DECLARE_PRIVATE(MEMBERS)
     #undef MEMBERS
     // PostOpRuntimeParam params[MAX_POSTOPS_NUM];
+    // int* c_row_index;  // CStoreMode::Scatter*: destination row of each row of A
+    // float* c_row_scale; // CStoreMode::Scatter*: weight of each row of A
+    // float* row_reduce_val; // RowReduceAlg: reduced values, [M, slots]
+    // int* row_reduce_idx;   // RowReduceAlg::ArgMax/TopK: column of each reduced value, [M, slots]
+    // float* norm_gamma;     // RowNormAlg::LayerNorm/RMSNorm: scale, [N]
+    // float* norm_beta;      // RowNormAlg::LayerNorm: shift, [N]
+    // float* a_scale;        // u8 A: dequantization scale of each row of A, [M]
+    // float* b_scale;        // u8 A: dequantization scale of each column of B, [N]
+    // int* b_comp;           // u8 A: 128 * sum(B[:, n]) removing the shift of A, [N]
+};
+
+// how the result rows are written to C
+enum class CStoreMode {
+    // c[m] = result[m]
+    Normal,
+    // c[c_row_index[m]] = result[m] * c_row_scale[m]
+    Scatter,
+    // c[c_row_index[m]] += result[m] * c_row_scale[m], indices must be unique in one call,
+    // so no atomic is needed; callers combining several experts into one C must serialize the calls
+    ScatterAccumulate,
+};
+
+// row-wise reduction of the output, computed while the row is still in registers
+enum class RowReduceAlg {
+    None,
+    Sum,
+    Max,
+    // max value and its first column
+    ArgMax,
+    // k largest values and their columns, descending
+    TopK,
+    // log(sum(exp(x))), gemm_kernel writes max and sum(exp(x - max)) per row, matmul finishes it
+    LogSumExp,
+    // mean and variance
+    Moments,
+    // sum(x * x)
+    SumSquare,
+};
+
+#define MAX_ROW_REDUCE_K 16
+struct RowReduceStaticParam {
+    RowReduceAlg alg = RowReduceAlg::None;
+    int k = 1;              // TopK only, in [1, MAX_ROW_REDUCE_K]
+    bool skip_c = false;    // only write the reduced result, C is not touched
+    int ld = 0;             // elements between two rows of the reduced output, 0 means packed
+};
+
+// number of reduced values per row written by gemm_kernel
+inline int get_row_reduce_slots(const RowReduceStaticParam& param) {
+    switch (param.alg) {
+        case RowReduceAlg::None: return 0;
+        case RowReduceAlg::TopK: return param.k;
+        case RowReduceAlg::LogSumExp:
+        case RowReduceAlg::Moments: return 2;
+        default: return 1;
+    }
+}
+
+// row-wise normalization of the output, applied after post ops
+enum class RowNormAlg {
+    None,
+    Softmax,
+    LogSoftmax,
+    // (x - mean) / sqrt(var + eps) * gamma + beta
+    LayerNorm,
+    // x / sqrt(mean(x * x) + eps) * gamma
+    RMSNorm,
+};
+
+struct RowNormStaticParam {
+    // gemm_kernel: N must be the whole row; matmul: rows wider than one N block are normalized in a second pass
+    RowNormAlg alg = RowNormAlg::None;
+    float eps = 1e-5f;
+};
+
+// B block sparsity: B is split in blocks of 16 rows x 16 columns, zero blocks are skipped by the jit code
+struct BSparseStaticParam {
+    // [ceil(K / 16), ceil(N / 16)], 0 means the block is zero; nullptr means it is derived from b
+    const uint8_t* block_mask = nullptr;
+    int ld_mask = 0;        // elements between two rows of block_mask, 0 means ceil(N / 16)
+    // B values with ldb, nonzero blocks are packed contiguously at init and the runtime b is not used
+    const float* b = nullptr;
+};
+
+// dynamic quantization, matmul with a_type f32 and b_type s8: every M block of A is quantized per row
+// to u8 right before the vnni kernel consumes it, a = round(a_f32 / a_scale) + 128, a_scale = absmax / 127.
+// gemm_kernel itself takes the quantized A with a_type u8, see PostOpRuntimeParams::a_scale
+struct QuantStaticParam {
+    // [N, K] with ldb bytes between two rows, packed at init and the runtime b is not used
+    const int8_t* b = nullptr;
+    const float* b_scale = nullptr;     // [N]
+};
+
+// register blocking of the kernel, 0 means the built in heuristic
+struct GemmBlockingParam {
+    int ur_num = 0;         // rows per register block, ceil(N / 16) * (ur_num + 1) + 1 must not exceed 32
+    int m_group = 0;        // rows walked with the lda stride inside one register block, so they share pages
+    int N_block = 0;        // matmul only: columns of one kernel, multiple of 16 up to 64 or not less than N
+    // matmul only: time the candidates on tune_m at init and keep the fastest for the dense f32 kernel,
+    // the choice is cached per cpu model and shape in memory and in the file named by BOAT_TUNE_CACHE
+    bool autotune = false;
+    int tune_m[4] = {};     // unused entries are 0, all 0 means 32, 256 and 2048
+};
+
+// software prefetch of the kernel, distances count k loop iterations of 16 k; 0 picks the default for the
+// shape, a negative value turns the prefetch off
+struct GemmPrefetchParam {
+    int a_dist = 0;         // prefetcht0 the ur rows of A, on by default when one row spans a page
+    int b_dist = 0;         // prefetcht0 the B rows, on by default when the B panel does not fit in L1
+    int c = 0;              // > 0 prefetchw the C lines of a register block before its k loop, on by default
+                            // when the C lines of an m group of register blocks do not fit in L1, never with c_stream
+};
+
+// matmul only: copy B into the memory of every NUMA node at init, the threads of each node take a share of
+// the work and read their local copy; needs the TBB runtime, nothing is copied on a single node
+struct GemmNumaParam {
+    bool replicate_b = false;
+    // f32 B with K rows of ldb bytes, the copies are used when the runtime b is this pointer;
+    // with quant the packed int8 B is copied
+    const float* b = nullptr;
+    // NUMA node ids that get a copy, nullptr takes every node of the machine; -1 is an arena without a node
+    // constraint, so several of them split the work like nodes on a single node machine
+    const int* nodes = nullptr;
+    int node_num = 0;
+};
+
+// matmul only: how the M x N blocks are handed to the threads
+enum class GemmSchedule {
+    Auto,           // Dynamic on hybrid cpus, whose efficiency cores would hold up a static split, else Static
+    Static,         // balance211 ranges fixed before the run, every block is assumed to cost the same
+    Dynamic         // threads grab chunk blocks at a time from a shared counter, slow threads take fewer
+};
+struct GemmScheduleParam {
+    GemmSchedule kind = GemmSchedule::Auto;
+    int chunk = 0;          // Dynamic: blocks per grab, 0 means 1
+    // by default a call uses only as many threads as its flops and bytes pay for, given the wake up time
+    // measured at init, small M runs on the calling thread; true always uses every thread
+    bool all_threads = false;
+};
+
+// threads a primitive runs on: work submitted through a context runs in its own TBB arena,
+// so primitives of different models do not share workers or caches
+struct ExecContextParam {
+    int nthread = 0;            // 0 means cpu_num, or the default thread number without cpus
+    // cpus the threads are pinned to, thread i of the arena to cpus[i % cpu_num]; linux and TBB only
+    int cpu_num = 0;
+    const int* cpus = nullptr;
+};
+struct exec_context {
+    exec_context();
+    bool init(const ExecContextParam& param);
+    int nthread() const;
+    // runs f on the calling thread inside the arena, parallel loops of f use the context threads
+    void execute(const std::function<void()>& f);
+
+    struct exec_context_impl;
+    std::shared_ptr<exec_context_impl> _impl;
 };
 
 // compile time constant
 struct GemmDynMStaticParam {
+    // f32/f32/f32; matmul: f32/s8/f32 with quant; gemm_kernel: u8/s8/f32, A rows hold K rounded up to 4
+    // and B is [ceil(K / 4)][ldb / 4][4], quads of K next to each other (vnni layout)
     dnnl_data_type_t a_type, b_type, c_type;
     int N, K;   // for kernel N must be in [1, 64]
     int lda, ldb, ldc;
     PostOpStaticParams post_static_params;
+    CStoreMode c_store_mode = CStoreMode::Normal;
+    RowReduceStaticParam row_reduce;
+    RowNormStaticParam row_norm;
+    BSparseStaticParam b_sparse;
+    // skip the K columns whose A values are zero in the whole row block, pays off for post-ReLU activations
+    // with more than about half zeros. Results match except when B holds inf/nan
+    bool skip_zero_a = false;
+    QuantStaticParam quant;
+    GemmBlockingParam blocking;
+    GemmPrefetchParam prefetch;
+    GemmNumaParam numa;
+    GemmScheduleParam schedule;
+    // gemm_kernel: write C with non-temporal stores (the masked N tail excluded) and sfence at the end,
+    // C and ldc must be 64 byte aligned; matmul picks it itself when C is larger than L3
+    bool c_stream = false;
+    // gemm_kernel: B, C, ldb and ldc are 64 byte aligned, full vectors of B and C use the aligned forms;
+    // matmul picks it itself for each call whose pointers allow it
+    bool aligned = false;
+    // gemm_kernel: > 0 compiles the kernel for exactly this m without any runtime tail dispatch,
+    // the runtime m must match
+    int fixed_m = 0;
+    // matmul: M values, e.g. the common batch sizes, that get kernels compiled for the m of their M blocks,
+    // unused entries are 0; other M values run the generic kernels
+    int hot_m[8] = {};
+    // matmul: context the calls run in, nullptr uses the arena of the caller
+    exec_context* context = nullptr;
 };
 // runtime changable
 struct GemmDynMRuntimeParam {
@@ -195,6 +398,8 @@ struct GemmDynMRuntimeParam {
     void* b;
     void* c;
     PostOpRuntimeParams post_runtime_params;
+    // matmul: context of this call, overrides the static one
+    exec_context* context = nullptr;
 };
 template <cpu_isa_t isa>
 struct gemm_kernel {
@@ -206,6 +411,8 @@ struct gemm_kernel {
     std::shared_ptr<gemm_kernel_impl> _impl;
 };
 
+// calls of one matmul may run from several threads at once; a call does not allocate once a call of its M
+// ran before or its M is in hot_m, apart from the threading runtime and more than 8 calls at the same time
 struct matmul {
     matmul();
     bool init(const GemmDynMStaticParam& static_param);
@@ -215,4 +422,184 @@ struct matmul {
     std::shared_ptr<matmul_impl> _impl;
 };
 
+// compile time constant
+struct NormStaticParam {
+    dnnl_data_type_t data_type;
+    RowNormAlg alg;
+    int N;                  // row length
+    int ld_src, ld_dst;     // bytes between two rows
+    float eps = 1e-5f;
+};
+// runtime changable
+struct NormRuntimeParam {
+    int m;
+    void* src;
+    void* dst;
+    float* gamma;           // LayerNorm/RMSNorm: [N]
+    float* beta;            // LayerNorm: [N]
+};
+
+// standalone softmax/log softmax/layer norm/rms norm over rows, dst may be src
+struct norm {
+    norm();
+    bool init(const NormStaticParam& static_param);
+    void operator()(const NormRuntimeParam& runtime_param);
+
+    struct norm_impl;
+    std::shared_ptr<norm_impl> _impl;
+};
+
+// compile time constant, src and dst are NHWC, weights are [KH, KW, IC, OC]
+struct ConvStaticParam {
+    dnnl_data_type_t src_type, wei_type, dst_type;
+    int IC, OC;
+    int IH, IW, OH, OW;
+    int KH, KW;
+    int stride_h, stride_w;
+    int pad_t, pad_l;       // bottom and right padding follow from OH and OW
+    PostOpStaticParams post_static_params;  // PerElement is not supported
+};
+// runtime changable
+struct ConvRuntimeParam {
+    int mb;
+    void* src;
+    void* wei;
+    void* dst;
+    PostOpRuntimeParams post_runtime_params;
+};
+
+// implicit gemm: the rows of A are computed from the output pixels inside the jit code, no im2col buffer
+struct conv {
+    conv();
+    bool init(const ConvStaticParam& static_param);
+    void operator()(const ConvRuntimeParam& runtime_param);
+
+    struct conv_impl;
+    std::shared_ptr<conv_impl> _impl;
+};
+
+// compile time constant, src and dst are NHWC, weights are [KH, KW, C]
+struct DwConvStaticParam {
+    dnnl_data_type_t src_type, wei_type, dst_type;
+    int C;
+    int IH, IW, OH, OW;
+    int KH, KW;
+    int stride_h, stride_w;
+    int pad_t, pad_l;       // bottom and right padding follow from OH and OW
+    PostOpStaticParams post_static_params;  // PerElement is not supported
+};
+// runtime changable
+struct DwConvRuntimeParam {
+    int mb;
+    void* src;
+    void* wei;
+    void* dst;
+    PostOpRuntimeParams post_runtime_params;
+};
+
+// depthwise convolution, vectorized along channels
+struct dw_conv {
+    dw_conv();
+    bool init(const DwConvStaticParam& static_param);
+    void operator()(const DwConvRuntimeParam& runtime_param);
+
+    struct dw_conv_impl;
+    std::shared_ptr<dw_conv_impl> _impl;
+};
+
+enum class AttnMaskType {
+    None,
+    // query row i sees key columns [0, i + kv_len - q_len]; a call with kv_len less than q_len is an error,
+    // it asserts in debug builds and leaves out unwritten otherwise
+    Causal,
+    // float mask [q_len, kv_len] added to the scaled scores, shared by all batches
+    PerElement,
+};
+
+// compile time constant
+struct AttentionStaticParam {
+    dnnl_data_type_t data_type;
+    int head_size;              // must be in [1, 64]
+    int ldq, ldk, ldv, ldo;     // bytes between two tokens
+    float scale;                // 0 means 1 / sqrt(head_size)
+    AttnMaskType mask_type = AttnMaskType::None;
+    int ld_mask = 0;            // PerElement: bytes between two rows of the mask
+};
+// runtime changable
+struct AttentionRuntimeParam {
+    int batch;                  // batch * heads
+    int q_len, kv_len;
+    void* q;                    // [batch, q_len, head_size]
+    void* k;                    // [batch, kv_len, head_size]
+    void* v;                    // [batch, kv_len, head_size]
+    void* out;                  // [batch, q_len, head_size]
+    float* mask;                // PerElement: [q_len, kv_len]
+    // bytes between two batches
+    size_t batch_stride_q, batch_stride_k, batch_stride_v, batch_stride_out;
+};
+
+// softmax(q * k' * scale + mask) * v, scores are kept in registers and never reach memory;
+// one attention may be called from several threads at once
+struct attention {
+    attention();
+    bool init(const AttentionStaticParam& static_param);
+    void operator()(const AttentionRuntimeParam& runtime_param);
+
+    struct attention_impl;
+    std::shared_ptr<attention_impl> _impl;
+};
+
+// compile time constant, 4 byte units are moved: dst[c / group][r][c % group] = src[r][c]
+struct TransposeStaticParam {
+    int elem_size;              // bytes of one element: 1, 2 or 4
+    int group;                  // elements kept together, elem_size * group must be 4:
+                                // 1 for fp32, 2 for bf16 pairs, 4 for int8 quads (vnni layout)
+    int cols;                   // elements in one src row, must be a multiple of group
+    int ld_src, ld_dst;         // bytes between two rows, multiple of 4
+};
+// runtime changable
+struct TransposeRuntimeParam {
+    int rows;
+    void* src;                  // [rows, cols]
+    void* dst;                  // [cols / group, rows, group], only the first rows units of a dst row are written
+};
+
+// [rows, cols] -> [cols, rows] reorder through 16x16 register tiles, also converts [N, K] to the vnni layout
+struct transpose {
+    transpose();
+    bool init(const TransposeStaticParam& static_param);
+    void operator()(const TransposeRuntimeParam& runtime_param);
+
+    struct transpose_impl;
+    std::shared_ptr<transpose_impl> _impl;
+};
+
+// compile time constant
+struct QuantizeStaticParam {
+    int K;                      // row length
+    int ld_src, ld_dst;         // bytes between two rows, dst rows hold K rounded up to 4, the padding is 128
+};
+// runtime changable
+struct QuantizeRuntimeParam {
+    int m;
+    void* src;                  // f32 [m, K]
+    void* dst;                  // u8 [m, K]
+    float* scale;               // [m]
+};
+
+// dynamic symmetric per row quantization: scale = absmax / 127, dst = round(src / scale) + 128
+struct quantize {
+    quantize();
+    bool init(const QuantizeStaticParam& static_param);
+    void operator()(const QuantizeRuntimeParam& runtime_param);
+
+    struct quantize_impl;
+    std::shared_ptr<quantize_impl> _impl;
+};
+
+// threadpool runtime (BOAT_CPU_RUNTIME=THREADPOOL) only: parallel work started from the calling thread
+// runs on tp, see oneapi/dnnl/dnnl_threadpool_iface.hpp; nullptr runs it on the calling thread.
+// the other runtimes ignore it
+void set_threadpool(dnnl::threadpool_interop::threadpool_iface* tp);
+
 };
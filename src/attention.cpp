@@ -0,0 +1,376 @@
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include <assert.h>
+#include <cmath>
+#include <limits>
+
+#include <coat/Function.h>
+#include <coat/ControlFlow.h>
+#include <coat/Vec.h>
+#include <coat/Mask.h>
+#include "dnnl_thread.hpp"
+#include "boat.h"
+#include "jit_math.h"
+#include "scratch_pool.h"
+
+#define ENABLE_DUMP 0
+
+using namespace dnnl::impl;
+using namespace dnnl::impl::utils;
+
+namespace boat {
+
+//
+// one head, q rows are handled ur_num at a time, for each row block:
+//   for kv_block in 0..kv_end step width
+//     s = q * kt_block                 --> fma, kt is packed as [kv_len / width][head_size][width]
+//     s = s * scale + mask
+//     m' = max(m, rowmax(s)), p = exp(s - m'), l = l * exp(m - m') + rowsum(p), acc = acc * exp(m - m')
+//     acc += p * v_block               --> fma, p goes through the stack to be broadcast
+//   out = acc / l
+// kv_end stops at the last visible column for causal mask
+//
+using attn_func_t = void (*)(int q_len, int kv_len, int causal_offset, float* q, float* kt, float* v, float* out, float* mask);
+template <unsigned width>
+static attn_func_t make_attention(const AttentionStaticParam& static_param) {
+    int head_size = static_param.head_size;
+    int ldq = static_param.ldq / sizeof(float);
+    int ldv = static_param.ldv / sizeof(float);
+    int ldo = static_param.ldo / sizeof(float);
+    int ldm = static_param.ld_mask / sizeof(float);
+    auto mask_type = static_param.mask_type;
+    float scale = static_param.scale ? static_param.scale : 1.0f / std::sqrt(static_cast<float>(head_size));
+    auto fn = coat::createFunction<attn_func_t>("attention");
+    if constexpr (width == 16)
+        fn.funcNode->frame().setAvx512Enabled();
+    else if  constexpr (width == 8)
+        fn.funcNode->frame().setAvxEnabled();
+#if ENABLE_DUMP
+    fn.enableCodeDump();
+#endif
+    int oc_num = (head_size + width - 1) / width;
+    if (oc_num <= 0 || oc_num > 4) {
+        std::cout << "head_size must be in [1, 64]" << std::endl;
+        return nullptr;
+    }
+    // oc_num:               1  2  3  4
+    static int ur_table[] = {6, 4, 4, 3};
+    int ur_num = ur_table[oc_num - 1];
+    {
+        auto [j_q_len, j_kv_len, j_causal_offset, j_q, j_kt, j_v, j_out, j_mask] =
+            fn.getArguments("q_len", "kv_len", "causal_offset", "q", "kt", "v", "out", "mask");
+        bool has_h_tail = (head_size % width) != 0;
+        coat::Mask j_h_mask("h_tail");
+        if (has_h_tail) {
+            coat::Value<int> j_bits((1 << (head_size % width)) - 1);
+            _CC.kmovw(j_h_mask.reg, j_bits.reg);
+        }
+        // p of the current kv block, one vector per row
+        auto j_p_buf = _CC.newStack(ur_num * width * sizeof(float), 64, "p");
+        auto p_mem = [&] (int m, int col, int size) {
+            auto mem = j_p_buf;
+            mem.addOffset((m * width + col) * sizeof(float));
+            mem.setSize(size);
+            return mem;
+        };
+        auto lanes = _CC.newConst(asmjit::ConstPoolScope::kLocal, lane_index, width * sizeof(int));
+
+        std::vector<share_vec<width>> j_acc, j_s, j_max, j_sum;
+        for (int i = 0; i < ur_num * oc_num; i++)
+            j_acc.push_back(std::make_shared<coat::Vec<float, width>>());
+        for (int i = 0; i < ur_num; i++) {
+            j_s.push_back(std::make_shared<coat::Vec<float, width>>());
+            j_max.push_back(std::make_shared<coat::Vec<float, width>>());
+            j_sum.push_back(std::make_shared<coat::Vec<float, width>>());
+        }
+        coat::Vec<float, width> j_data, j_tmp, j_lowest, j_col, j_row;
+        std::vector<share_vec<width>> j_v_vecs(oc_num);
+        for (int i = 0; i < oc_num; i++)
+            j_v_vecs[i] = std::make_shared<coat::Vec<float, width>>();
+        coat::Mask j_kv_mask("kv_tail"), j_causal("causal");
+        coat::Value<int> j_i(int(0), "i");
+
+        // s = q * kt for one kv block, then scale, mask and online softmax
+        auto score = [&] (int ur_num, coat::wrapper_type<float*>& j_q_row, coat::wrapper_type<float*>& j_kt_block,
+            coat::wrapper_type<float*>& j_mask_block, bool has_kv_tail) {
+            for (int m = 0; m < ur_num; m++)
+                *j_s[m] = 0;
+            for (int d = 0; d < head_size; d++) {
+                j_tmp.load(j_kt_block[d * width]);
+                for (int m = 0; m < ur_num; m++) {
+                    j_data.load(j_q_row[m * ldq + d], true);
+                    j_s[m]->fma231(j_tmp, j_data);
+                }
+            }
+            j_tmp = scale;
+            for (int m = 0; m < ur_num; m++) {
+                j_s[m]->mul(j_tmp);
+                if (mask_type == AttnMaskType::PerElement) {
+                    if (has_kv_tail) {
+                        j_data.kzload(j_mask_block[m * ldm], j_kv_mask);
+                        j_s[m]->add(j_data);
+                    } else {
+                        j_s[m]->add(j_mask_block[m * ldm]);
+                    }
+                } else if (mask_type == AttnMaskType::Causal) {
+                    // column > row + causal_offset is invisible
+                    j_data = static_cast<float>(m);
+                    j_data.add(j_row);
+                    _CC.vcmpps(j_causal.reg, j_col.reg, j_data.reg, 0x1E); // _CMP_GT_OQ
+                    _CC.k(j_causal.reg).vmovaps(j_s[m]->reg, j_lowest.reg);
+                }
+                if (has_kv_tail)
+                    _CC.k(j_kv_mask.reg).vblendmps(j_s[m]->reg, j_lowest.reg, j_s[m]->reg);
+            }
+            for (int m = 0; m < ur_num; m++) {
+                auto& s = *j_s[m];
+                j_data = s;
+                jit_reduce<width>(j_data, true);
+                j_data.max_(*j_max[m]);
+                // correction of the old sum and acc
+                j_tmp = *j_max[m];
+                j_tmp.sub(j_data);
+                jit_exp<width>(j_tmp);
+                *j_max[m] = j_data;
+                s.sub(j_data);
+                jit_exp<width>(s);
+                if (has_kv_tail)
+                    _CC.k(j_kv_mask.reg).z().vmovaps(s.reg, s.reg);
+                _CC.vmovups(p_mem(m, 0, width * sizeof(float)), s.reg);
+                j_data = s;
+                jit_reduce<width>(j_data, false);
+                j_sum[m]->mul(j_tmp);
+                j_sum[m]->add(j_data);
+                for (int n = 0; n < oc_num; n++)
+                    j_acc[m * oc_num + n]->mul(j_tmp);
+            }
+        };
+        // acc += p * v for the column col of the kv block
+        auto pv = [&] (int ur_num, int col, coat::wrapper_type<float*>& j_v_block) {
+            for (int n = 0; n < oc_num - has_h_tail; n++)
+                j_v_vecs[n]->load(j_v_block[col * ldv + n * width]);
+            if (has_h_tail)
+                j_v_vecs[oc_num - 1]->kzload(j_v_block[col * ldv + (oc_num - 1) * width], j_h_mask);
+            for (int m = 0; m < ur_num; m++) {
+                _CC.vbroadcastss(j_data.reg, p_mem(m, col, sizeof(float)));
+                for (int n = 0; n < oc_num; n++)
+                    j_acc[m * oc_num + n]->fma231(*j_v_vecs[n], j_data);
+            }
+        };
+        auto attend = [&] (int ur_num, coat::wrapper_type<float*>& j_q_row, coat::wrapper_type<float*>& j_out_row,
+            coat::wrapper_type<float*>& j_mask_row) {
+            j_lowest = std::numeric_limits<float>::lowest();
+            for (int m = 0; m < ur_num; m++) {
+                *j_max[m] = j_lowest;
+                *j_sum[m] = 0;
+                for (int n = 0; n < oc_num; n++)
+                    *j_acc[m * oc_num + n] = 0;
+            }
+            coat::Value<int> j_kv_end("kv_end");
+            j_kv_end = j_kv_len;
+            if (mask_type == AttnMaskType::Causal) {
+                // row + causal_offset of the first row, column index of every lane
+                coat::Value<int> j_first("first");
+                j_first = j_i;
+                j_first += j_causal_offset;
+                _CC.vpbroadcastd(j_row.reg, j_first.reg);
+                _CC.vcvtdq2ps(j_row.reg, j_row.reg);
+                _CC.vcvtdq2ps(j_col.reg, lanes);
+                j_kv_end = j_first;
+                j_kv_end += ur_num;
+                coat::if_then(j_kv_end > j_kv_len, [&] {
+                    j_kv_end = j_kv_len;
+                });
+            }
+            coat::Value<int> j_kv_full("kv_full");
+            j_kv_full = j_kv_end;
+            j_kv_full &= -static_cast<int>(width);
+            coat::Value<int> j_j(int(0), "j");
+            auto j_kt_block = j_kt;
+            auto j_v_block = j_v;
+            auto j_mask_block = j_mask_row;
+            coat::for_loop(j_j < j_kv_full,
+                [&] {
+                    j_j += width;
+                    j_kt_block += width * head_size;
+                    j_v_block += width * ldv;
+                    if (mask_type == AttnMaskType::PerElement)
+                        j_mask_block += width;
+                    if (mask_type == AttnMaskType::Causal) {
+                        j_tmp = static_cast<float>(width);
+                        j_col.add(j_tmp);
+                    }
+                },
+                [&] {
+                    score(ur_num, j_q_row, j_kt_block, j_mask_block, false);
+                    for (int col = 0; col < static_cast<int>(width); col++)
+                        pv(ur_num, col, j_v_block);
+                });
+            // kv tail
+            coat::if_then(j_j != j_kv_end, [&] {
+                coat::Value<int> j_tail("kv_tail");
+                coat::Value<int> j_bits(int(1), "bits");
+                j_tail = j_kv_end;
+                j_tail -= j_j;
+                j_bits <<= j_tail;
+                j_bits -= 1;
+                _CC.kmovw(j_kv_mask.reg, j_bits.reg);
+                score(ur_num, j_q_row, j_kt_block, j_mask_block, true);
+                asmjit::Label L_End = _CC.newLabel();
+                for (int col = 0; col < static_cast<int>(width); col++) {
+                    if (col) {
+                        coat::if_then(j_tail == col, [&] {
+                            _CC.jmp(L_End);
+                        });
+                    }
+                    pv(ur_num, col, j_v_block);
+                }
+                _CC.bind(L_End);
+            });
+            for (int m = 0; m < ur_num; m++) {
+                j_tmp = 1.0f;
+                j_tmp.div(*j_sum[m]);
+                for (int n = 0; n < oc_num; n++)
+                    j_acc[m * oc_num + n]->mul(j_tmp);
+                for (int n = 0; n < oc_num - has_h_tail; n++)
+                    j_acc[m * oc_num + n]->store(j_out_row[m * ldo + n * width]);
+                if (has_h_tail)
+                    j_acc[m * oc_num + oc_num - 1]->kstore(j_out_row[m * ldo + (oc_num - 1) * width], j_h_mask);
+            }
+        };
+
+        auto j_q_block = j_q_len;
+        j_q_block /= ur_num;
+        j_q_block *= ur_num;
+        coat::for_loop(j_i < j_q_block,
+        [&] {
+            j_i += ur_num;
+            j_q += ur_num * ldq;
+            j_out += ur_num * ldo;
+            if (mask_type == AttnMaskType::PerElement)
+                j_mask += ur_num * ldm;
+        },
+        [&] {
+            attend(ur_num, j_q, j_out, j_mask);
+        });
+        // q tail
+        coat::if_then(j_q_block != j_q_len, [&] {
+            j_q_len -= j_q_block;
+            asmjit::Label L_End = _CC.newLabel();
+            for (int i = 1; i < ur_num; i++) {
+                auto n = i;
+                coat::if_then(j_q_len == n, [&] {
+                    attend(n, j_q, j_out, j_mask);
+                    _CC.jmp(L_End);
+                });
+            }
+            _CC.bind(L_End);
+        });
+        // specify return value
+        coat::ret();
+    }
+
+    // finalize code generation and get function pointer to the generated function
+    auto foo = fn.finalize();
+    return foo;
+}
+
+struct attention::attention_impl {
+    attn_func_t _func = nullptr;
+    int _nthread = 0;
+    AttentionStaticParam _static_param;
+    // k packed as [batch][kv_len / 16][head_size][16], tail block zero padded; owned by one call at a time
+    scratch_pool<std::vector<float>> _kt;
+    // one kv block [16, head_size] -> [head_size, 16]
+    transpose _pack_k;
+
+    bool init(const AttentionStaticParam& static_param) {
+        if (static_param.data_type != dnnl_f32)
+            return false;
+        _nthread = dnnl_get_max_threads();
+        _static_param = static_param;
+        _func = make_attention<16>(static_param);
+        TransposeStaticParam pack_param = {
+            sizeof(float), 1, static_param.head_size, static_param.ldk, 16 * sizeof(float)
+        };
+        return _func != nullptr && _pack_k.init(pack_param);
+    }
+
+    void pack_k(const AttentionRuntimeParam& runtime_param, std::vector<float>& kt) {
+        const int width = 16;
+        auto head_size = _static_param.head_size;
+        auto kv_len = runtime_param.kv_len;
+        int kv_blocks = (kv_len + width - 1) / width;
+        size_t batch_size = static_cast<size_t>(kv_blocks) * head_size * width;
+        if (kt.size() < batch_size * runtime_param.batch)
+            kt.resize(batch_size * runtime_param.batch);
+        parallel_nd(runtime_param.batch * kv_blocks, [&](dim_t i) {
+            int b = static_cast<int>(i / kv_blocks), jb = static_cast<int>(i % kv_blocks);
+            float* dst = kt.data() + b * batch_size + static_cast<size_t>(jb) * head_size * width;
+            auto src = static_cast<uint8_t*>(runtime_param.k) + b * runtime_param.batch_stride_k;
+            int rows = std::min(width, kv_len - jb * width);
+            if (rows < width)
+                std::fill(dst, dst + head_size * width, 0.0f);
+            TransposeRuntimeParam pack_runtime = {
+                rows, src + static_cast<size_t>(jb * width) * _static_param.ldk, dst
+            };
+            _pack_k(pack_runtime);
+        });
+    }
+
+    void exec(const AttentionRuntimeParam& runtime_param) {
+        assert(_func);
+        bool causal = _static_param.mask_type == AttnMaskType::Causal;
+        if (causal && runtime_param.kv_len < runtime_param.q_len) {
+            std::cout << "causal attention needs kv_len >= q_len" << std::endl;
+            assert(false);
+            return;
+        }
+        auto kt = _kt.acquire();
+        pack_k(runtime_param, *kt);
+        const int width = 16;
+        size_t kt_batch_size = static_cast<size_t>((runtime_param.kv_len + width - 1) / width) * _static_param.head_size * width;
+        // several q blocks per thread so that the packed k and v of one head stay in cache
+        int q_block = 64;
+        while (q_block > 8 && runtime_param.batch * ((runtime_param.q_len + q_block - 1) / q_block) < _nthread)
+            q_block /= 2;
+        int q_block_num = (runtime_param.q_len + q_block - 1) / q_block;
+        int causal_offset = runtime_param.kv_len - runtime_param.q_len;
+        parallel_nd(runtime_param.batch * q_block_num, [&](dim_t i) {
+            int b = static_cast<int>(i / q_block_num), qb = static_cast<int>(i % q_block_num);
+            int q_start = qb * q_block;
+            int q_len = std::min(q_block, runtime_param.q_len - q_start);
+            auto q = static_cast<uint8_t*>(runtime_param.q) + b * runtime_param.batch_stride_q + static_cast<size_t>(q_start) * _static_param.ldq;
+            auto v = static_cast<uint8_t*>(runtime_param.v) + b * runtime_param.batch_stride_v;
+            auto out = static_cast<uint8_t*>(runtime_param.out) + b * runtime_param.batch_stride_out + static_cast<size_t>(q_start) * _static_param.ldo;
+            float* mask = nullptr;
+            if (_static_param.mask_type == AttnMaskType::PerElement)
+                mask = reinterpret_cast<float*>(reinterpret_cast<uint8_t*>(runtime_param.mask) + static_cast<size_t>(q_start) * _static_param.ld_mask);
+            // rows of this block are shifted by q_start against the first row of the head
+            _func(q_len, runtime_param.kv_len, causal_offset + q_start, reinterpret_cast<float*>(q),
+                kt->data() + b * kt_batch_size, reinterpret_cast<float*>(v), reinterpret_cast<float*>(out), mask);
+        });
+    }
+
+    ~attention_impl() {
+        if (_func)
+            coat::getJitRuntimeEnv().release_func(_func);
+    }
+};
+
+attention::attention() :
+    _impl(std::make_shared<attention_impl>()) {
+}
+
+bool attention::init(const AttentionStaticParam& static_param) {
+    return _impl->init(static_param);
+}
+
+void attention::operator()(const AttentionRuntimeParam& runtime_param) {
+    _impl->exec(runtime_param);
+}
+
+};
@@ -0,0 +1,119 @@
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include <assert.h>
+
+#include <coat/Function.h>
+#include <coat/ControlFlow.h>
+#include <coat/Vec.h>
+#include "dnnl_thread.hpp"
+#include "boat.h"
+#include "jit_math.h"
+#include "jit_conv.h"
+
+using namespace dnnl::impl;
+using namespace dnnl::impl::utils;
+
+namespace boat {
+
+//
+// K of a conv row: IC of every (kh, kw), A row of output pixel ow at (kh, kw) is src[kh][ow * stride_w - pad_l + kw][:]
+//
+// for k_block in 0..IC
+//   for k in k_block              --> fma
+//
+template <unsigned width>
+static conv_func_t make_conv_stride(const ConvStaticParam& static_param, int N) {
+    int IC = static_param.IC;
+    int ldb = static_param.OC;
+    conv_row_shape shape = {
+        static_param.IW, static_param.OW, static_param.KW, static_param.stride_w, static_param.pad_l,
+        IC, static_param.OC, static_param.IW * IC, static_param.KW * IC * ldb, IC * ldb
+    };
+    // oc_num:                     1  2  3  4
+    static const int ur_table[] = {8, 8, 8, 6};
+    auto load_b = [] (auto& vec, auto&& mem) {
+        vec.load(std::move(mem));
+    };
+    return make_conv_row<width>("conv", shape, static_param.post_static_params, N, ur_table,
+        [&] (jit_gemm_block<width>& block, int ur_num, coat::wrapper_type<float*>& j_a, coat::wrapper_type<float*>& j_b,
+            int lda, int a_offset, int b_offset) {
+            coat::Value<int> j_k(int(0), "k");
+            auto j_a_row = j_a;
+            auto j_b_row = j_b;
+            //for (k = 0; k < IC; k += width) {
+            coat::for_loop(j_k < IC / width * width,
+                [&] {
+                    j_k += width;
+                    j_b_row += width * ldb;
+                    j_a_row += width;
+                },
+                [&] {
+                    block.fma(ur_num, width, j_a_row, j_b_row, lda, ldb, load_b, false, a_offset, b_offset);
+                });
+            // IC tail
+            if (IC % width != 0)
+                block.fma(ur_num, IC % width, j_a_row, j_b_row, lda, ldb, load_b, false, a_offset, b_offset);
+        });
+}
+
+struct conv::conv_impl {
+    conv_rows _rows;
+    ConvStaticParam _static_param;
+    // 1x1 without stride and padding is a plain gemm with M = mb * OH * OW
+    bool _is_gemm = false;
+    matmul _gemm;
+
+    bool init(const ConvStaticParam& static_param) {
+        if (static_param.src_type != dnnl_f32 || static_param.wei_type != dnnl_f32 || static_param.dst_type != dnnl_f32)
+            return false;
+        _static_param = static_param;
+        auto& p = static_param;
+        _is_gemm = p.KH == 1 && p.KW == 1 && p.stride_h == 1 && p.stride_w == 1 && p.pad_t == 0 && p.pad_l == 0 &&
+            p.IH == p.OH && p.IW == p.OW;
+        if (_is_gemm) {
+            GemmDynMStaticParam param = {
+                dnnl_f32, dnnl_f32, dnnl_f32,
+                p.OC, p.IC, p.IC * 4, p.OC * 4, p.OC * 4,
+                p.post_static_params
+            };
+            return _gemm.init(param);
+        }
+        conv_rows::shape_t shape = {
+            p.IH, p.OH, p.KH, p.stride_h, p.pad_t,
+            static_cast<size_t>(p.IW) * p.IC, static_cast<size_t>(p.KW) * p.IC * p.OC, static_cast<size_t>(p.OW) * p.OC, false
+        };
+        return _rows.init(shape, p.post_static_params, p.OC, get_N_block(p.OC), [&] (int N) {
+            return make_conv_stride<16>(static_param, N);
+        });
+    }
+
+    void exec(const ConvRuntimeParam& runtime_param) {
+        auto& p = _static_param;
+        if (_is_gemm) {
+            GemmDynMRuntimeParam param = {
+                runtime_param.mb * p.OH * p.OW, runtime_param.src, runtime_param.wei, runtime_param.dst,
+                runtime_param.post_runtime_params
+            };
+            _gemm(param);
+            return;
+        }
+        _rows.exec(runtime_param.mb, runtime_param.src, runtime_param.wei, runtime_param.dst, runtime_param.post_runtime_params);
+    }
+};
+
+conv::conv() :
+    _impl(std::make_shared<conv_impl>()) {
+}
+
+bool conv::init(const ConvStaticParam& static_param) {
+    return _impl->init(static_param);
+}
+
+void conv::operator()(const ConvRuntimeParam& runtime_param) {
+    _impl->exec(runtime_param);
+}
+
+};
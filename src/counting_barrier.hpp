@@ -0,0 +1,55 @@
+/*******************************************************************************
+* Copyright 2020-2022 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+#ifndef COMMON_COUNTING_BARRIER_HPP
+#define COMMON_COUNTING_BARRIER_HPP
+
+#include <assert.h>
+#include <condition_variable>
+#include <mutex>
+
+namespace dnnl {
+namespace impl {
+
+// Waits until notify() was called as many times as passed to init(), used to
+// join the closures of an asynchronous threadpool.
+struct counting_barrier_t {
+    void init(int count) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        count_ = count;
+    }
+
+    void notify() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        assert(count_ > 0);
+        if (--count_ == 0) cv_.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return count_ == 0; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int count_ = 0;
+};
+
+} // namespace impl
+} // namespace dnnl
+
+#endif
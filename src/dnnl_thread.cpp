@@ -0,0 +1,52 @@
+#include <thread>
+
+#include "dnnl_thread.hpp"
+#include "boat.h"
+
+#if DNNL_CPU_THREADING_RUNTIME == DNNL_RUNTIME_THREADPOOL
+namespace dnnl {
+namespace impl {
+namespace threadpool_utils {
+
+static thread_local dnnl::threadpool_interop::threadpool_iface *active_threadpool = nullptr;
+
+void activate_threadpool(dnnl::threadpool_interop::threadpool_iface *tp) {
+    active_threadpool = tp;
+}
+
+void deactivate_threadpool() {
+    active_threadpool = nullptr;
+}
+
+dnnl::threadpool_interop::threadpool_iface *get_active_threadpool() {
+    return active_threadpool;
+}
+
+int get_max_concurrency() {
+    return get_threadlocal_max_concurrency();
+}
+
+int &get_threadlocal_max_concurrency() {
+    thread_local int max_concurrency = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    return max_concurrency;
+}
+
+} // namespace threadpool_utils
+} // namespace impl
+} // namespace dnnl
+#endif
+
+namespace boat {
+
+void set_threadpool(dnnl::threadpool_interop::threadpool_iface* tp) {
+#if DNNL_CPU_THREADING_RUNTIME == DNNL_RUNTIME_THREADPOOL
+    if (tp)
+        dnnl::impl::threadpool_utils::activate_threadpool(tp);
+    else
+        dnnl::impl::threadpool_utils::deactivate_threadpool();
+#else
+    (void)tp;
+#endif
+}
+
+};
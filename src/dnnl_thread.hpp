@@ -141,8 +141,6 @@ inline void dnnl_thr_barrier() {
 #include "oneapi/dnnl/dnnl_threadpool_iface.hpp"
 #define DNNL_THR_SYNC 0
 
-#include "cpu/platform.hpp"
-
 namespace dnnl {
 namespace impl {
 namespace threadpool_utils {
@@ -0,0 +1,94 @@
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include <assert.h>
+
+#include <coat/Function.h>
+#include <coat/ControlFlow.h>
+#include <coat/Vec.h>
+#include "dnnl_thread.hpp"
+#include "boat.h"
+#include "jit_math.h"
+#include "jit_conv.h"
+
+using namespace dnnl::impl;
+using namespace dnnl::impl::utils;
+
+namespace boat {
+
+//
+// a dw_conv row adds every (kh, kw) channel by channel, the weight of one kw is shared by the ur pixels
+//
+// for n in n_block                --> fma
+//   for m in ur
+//
+template <unsigned width>
+static conv_func_t make_dw_conv(const DwConvStaticParam& static_param, int N) {
+    int C = static_param.C;
+    conv_row_shape shape = {
+        static_param.IW, static_param.OW, static_param.KW, static_param.stride_w, static_param.pad_l,
+        C, C, static_param.IW * C, static_param.KW * C, C
+    };
+    // oc_num:                     1  2  3  4
+    static const int ur_table[] = {8, 6, 6, 5};
+    return make_conv_row<width>("dw_conv", shape, static_param.post_static_params, N, ur_table,
+        [] (jit_gemm_block<width>& block, int ur_num, coat::wrapper_type<float*>& j_a, coat::wrapper_type<float*>& j_b,
+            int lda, int a_offset, int b_offset) {
+            int oc_num = block.oc_num;
+            bool has_n_tail = block.has_n_tail;
+            auto& j_weight = block.weight;
+            auto& j_result = block.result;
+            for (int n = 0; n < oc_num - has_n_tail; n++) {
+                j_weight[n]->load(j_b[b_offset + n * width]);
+            }
+            if (has_n_tail) {
+                j_weight[oc_num - 1]->kzload(j_b[b_offset + (oc_num - 1) * width], asmjit::x86::k1);
+            }
+            for (int m = 0; m < ur_num; m++) {
+                for (int n = 0; n < oc_num - has_n_tail; n++) {
+                    j_result[m * oc_num + n]->fma231(*j_weight[n], j_a[a_offset + m * lda + n * width]);
+                }
+                if (has_n_tail) {
+                    block.data.kzload(j_a[a_offset + m * lda + (oc_num - 1) * width], asmjit::x86::k1);
+                    j_result[m * oc_num + oc_num - 1]->fma231(*j_weight[oc_num - 1], block.data);
+                }
+            }
+        });
+}
+
+struct dw_conv::dw_conv_impl {
+    conv_rows _rows;
+
+    bool init(const DwConvStaticParam& static_param) {
+        if (static_param.src_type != dnnl_f32 || static_param.wei_type != dnnl_f32 || static_param.dst_type != dnnl_f32)
+            return false;
+        auto& p = static_param;
+        conv_rows::shape_t shape = {
+            p.IH, p.OH, p.KH, p.stride_h, p.pad_t,
+            static_cast<size_t>(p.IW) * p.C, static_cast<size_t>(p.KW) * p.C, static_cast<size_t>(p.OW) * p.C, true
+        };
+        return _rows.init(shape, p.post_static_params, p.C, std::min(p.C, 64), [&] (int N) {
+            return make_dw_conv<16>(static_param, N);
+        });
+    }
+
+    void exec(const DwConvRuntimeParam& runtime_param) {
+        _rows.exec(runtime_param.mb, runtime_param.src, runtime_param.wei, runtime_param.dst, runtime_param.post_runtime_params);
+    }
+};
+
+dw_conv::dw_conv() :
+    _impl(std::make_shared<dw_conv_impl>()) {
+}
+
+bool dw_conv::init(const DwConvStaticParam& static_param) {
+    return _impl->init(static_param);
+}
+
+void dw_conv::operator()(const DwConvRuntimeParam& runtime_param) {
+    _impl->exec(runtime_param);
+}
+
+};
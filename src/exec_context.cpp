@@ -0,0 +1,126 @@
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <unordered_map>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "dnnl_thread.hpp"
+#if DNNL_CPU_THREADING_RUNTIME == DNNL_RUNTIME_TBB
+#include "tbb/task_scheduler_observer.h"
+#endif
+#include "boat.h"
+
+using namespace dnnl::impl;
+
+namespace boat {
+
+#if DNNL_CPU_THREADING_RUNTIME == DNNL_RUNTIME_TBB && defined(__linux__)
+// pins every thread entering the arena to one cpu of the set and gives the old mask back on exit,
+// the calling thread of execute enters the arena too and must not stay pinned
+class pin_observer : public tbb::task_scheduler_observer {
+public:
+    pin_observer(tbb::task_arena& arena, const std::vector<int>& cpus) :
+        tbb::task_scheduler_observer(arena), _cpus(cpus) {
+        observe(true);
+    }
+    ~pin_observer() {
+        observe(false);
+    }
+
+    void on_scheduler_entry(bool) override {
+        auto idx = tbb::this_task_arena::current_thread_index();
+        if (idx < 0)
+            return;
+        pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &old_masks()[this]);
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        CPU_SET(_cpus[idx % _cpus.size()], &mask);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask);
+    }
+    void on_scheduler_exit(bool) override {
+        auto& masks = old_masks();
+        auto it = masks.find(this);
+        if (it == masks.end())
+            return;
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &it->second);
+        masks.erase(it);
+    }
+
+private:
+    // one saved mask per observer the thread is inside of: an execute of another context nested in a task
+    // of this one must not overwrite the mask this one gives back
+    static std::unordered_map<const pin_observer*, cpu_set_t>& old_masks() {
+        static thread_local std::unordered_map<const pin_observer*, cpu_set_t> masks;
+        return masks;
+    }
+    std::vector<int> _cpus;
+};
+#endif
+
+struct exec_context::exec_context_impl {
+    int _nthread = 0;
+#if DNNL_CPU_THREADING_RUNTIME == DNNL_RUNTIME_TBB
+    std::unique_ptr<tbb::task_arena> _arena;
+#ifdef __linux__
+    std::unique_ptr<pin_observer> _observer;
+#endif
+#endif
+
+    bool init(const ExecContextParam& param) {
+        if (param.nthread < 0 || param.cpu_num < 0 || (param.cpu_num && !param.cpus)) {
+            std::cout << "exec context needs nthread >= 0 and cpu_num ids in cpus" << std::endl;
+            return false;
+        }
+        _nthread = param.nthread ? param.nthread : (param.cpu_num ? param.cpu_num : dnnl_get_max_threads());
+#if DNNL_CPU_THREADING_RUNTIME == DNNL_RUNTIME_TBB
+        _arena = std::make_unique<tbb::task_arena>(_nthread);
+        _arena->initialize();
+        if (param.cpu_num) {
+#ifdef __linux__
+            std::vector<int> cpus(param.cpus, param.cpus + param.cpu_num);
+            _observer = std::make_unique<pin_observer>(*_arena, cpus);
+#else
+            std::cout << "pinning needs linux" << std::endl;
+            return false;
+#endif
+        }
+        return true;
+#else
+        // without an arena the thread number is still honored by the primitives
+        if (param.cpu_num) {
+            std::cout << "pinning needs the TBB runtime" << std::endl;
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    void execute(const std::function<void()>& f) {
+#if DNNL_CPU_THREADING_RUNTIME == DNNL_RUNTIME_TBB
+        _arena->execute(f);
+#else
+        f();
+#endif
+    }
+};
+
+exec_context::exec_context() :
+    _impl(std::make_shared<exec_context_impl>()) {
+}
+
+bool exec_context::init(const ExecContextParam& param) {
+    return _impl->init(param);
+}
+
+int exec_context::nthread() const {
+    return _impl->_nthread;
+}
+
+void exec_context::execute(const std::function<void()>& f) {
+    _impl->execute(f);
+}
+
+};
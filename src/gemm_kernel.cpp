@@ -6,68 +6,22 @@
 #include <chrono>
 #include <iostream>
 #include <assert.h>
+#include <limits>
 
 #include <coat/Function.h>
 #include <coat/ControlFlow.h>
 #include <coat/Vec.h>
 #include <coat/Mask.h>
 #include "boat.h"
+#include "gemm_kernel.h"
+#include "tool.h"
+#include "jit_math.h"
+#include "jit_postops.h"
+#include "jit_gemm.h"
 
 #define ENABLE_DUMP 0
 
 namespace boat {
-////////////////////////////////////////////////////
-// generate jit kernel needed param when injecting kernels, private
-struct PostOpInjectParam {
-    BinaryDataLayout layout;
-    coat::Ptr<coat::Value<float>> right_addrs_base;
-    std::vector<int> right_addrs_offset;
-};
-
-struct PostOpInjectParams {
-    PostOpInjectParam params[MAX_POSTOPS_NUM];
-};
-
-template<unsigned width>
-using share_vec = std::shared_ptr<coat::Vec<float, width>>;
-
-template <unsigned width>
-void inject_postops(int vecs_num, std::vector<share_vec<width>> vecs, PostOpStaticParams& ops_param, PostOpInjectParams& inject_ops_param) {
-    for (auto i = 0; i < ops_param.num; i++) {
-        switch (ops_param.ops[i].alg_type) {
-            case AlgType::Abs: {
-                coat::Vec<float, width> tmp;
-                std::for_each(vecs.begin(), vecs.begin() + vecs_num, [&] (share_vec<width> vec) {
-                    tmp = -0.f;
-                    tmp -= *vec;
-                    vec->max_(tmp);
-                });
-                break;
-            }
-            case AlgType::Add: {
-                if (inject_ops_param.params[i].layout == BinaryDataLayout::PerTensor) {
-                    coat::Vec<float, width> tmp;
-                    tmp.load(inject_ops_param.params[i].right_addrs_base[0], true);
-                    std::for_each(vecs.begin(), vecs.begin() + vecs_num, [&] (share_vec<width> vec) {
-                        *vec += tmp;
-                    });
-                } else if (inject_ops_param.params[i].layout == BinaryDataLayout::PerChannel) {
-                    auto& base = inject_ops_param.params[i].right_addrs_base;
-                    for (int j = 0; j < vecs_num; j++) {
-                        auto idx = inject_ops_param.params[i].right_addrs_offset[j];
-                        *vecs[j] += base[idx];
-                    }
-                }
-                break;
-            }
-            default:
-                // TODO: add other post ops
-                _CC.int3();
-                break;
-        }
-    }
-}
-
 // size should be runtime const
 template<int vectorsize>
 void jit_memset0(coat::Ptr<coat::Value<int8_t>> p, int size) {
@@ -160,6 +114,52 @@ void jit_memset0(coat::Ptr<coat::Value<int8_t>> p, int size) {
     }
 }
 
+// block sparse B: nonzero flag of every 16x16 block of B, [ceil(K / 16)][ceil(N / 16)]
+static std::vector<uint8_t> get_b_block_mask(const GemmDynMStaticParam& static_param) {
+    const int block = 16;
+    auto& b_sparse = static_param.b_sparse;
+    int k_blocks = (static_param.K + block - 1) / block;
+    int n_blocks = (static_param.N + block - 1) / block;
+    std::vector<uint8_t> block_mask(k_blocks * n_blocks, 1);
+    if (b_sparse.block_mask) {
+        int ld = b_sparse.ld_mask ? b_sparse.ld_mask : n_blocks;
+        for (int kb = 0; kb < k_blocks; kb++)
+            for (int nb = 0; nb < n_blocks; nb++)
+                block_mask[kb * n_blocks + nb] = b_sparse.block_mask[kb * ld + nb] != 0;
+    } else if (b_sparse.b) {
+        int ldb = static_param.ldb / sizeof(float);
+        for (int kb = 0; kb < k_blocks; kb++) {
+            for (int nb = 0; nb < n_blocks; nb++) {
+                bool nonzero = false;
+                for (int k = kb * block; k < std::min(static_param.K, (kb + 1) * block) && !nonzero; k++)
+                    for (int n = nb * block; n < std::min(static_param.N, (nb + 1) * block) && !nonzero; n++)
+                        nonzero = b_sparse.b[k * ldb + n] != 0;
+                block_mask[kb * n_blocks + nb] = nonzero;
+            }
+        }
+    }
+    return block_mask;
+}
+
+// block sparse B: nonzero blocks one after another in k block order, each is [16][16] padded with zero
+static void pack_b_blocks(const GemmDynMStaticParam& static_param, std::vector<float>& packed) {
+    const int block = 16;
+    auto block_mask = get_b_block_mask(static_param);
+    int ldb = static_param.ldb / sizeof(float);
+    int k_blocks = (static_param.K + block - 1) / block;
+    int n_blocks = (static_param.N + block - 1) / block;
+    packed.clear();
+    for (int kb = 0; kb < k_blocks; kb++) {
+        for (int nb = 0; nb < n_blocks; nb++) {
+            if (!block_mask[kb * n_blocks + nb])
+                continue;
+            for (int k = kb * block; k < (kb + 1) * block; k++)
+                for (int n = nb * block; n < (nb + 1) * block; n++)
+                    packed.push_back(k < static_param.K && n < static_param.N ? static_param.b_sparse.b[k * ldb + n] : 0.0f);
+        }
+    }
+}
+
 //
 // M: ur_num * m_group * M' + M_tail, M is runtime changeable
 // N: 16/32/48/64(may have tail)
@@ -180,9 +180,64 @@ void jit_memset0(coat::Ptr<coat::Value<int8_t>> p, int size) {
 //         for m in ur
 //           for n in n_block
 //     for k_block_tail in ..K
-using func_t = void (*)(int m, uint8_t* a, uint8_t* b, uint8_t* c, const PostOpRuntimeParams* post_runtime_params);
+// rows of a register block for oc_num vectors of N, 0 when blocking.ur_num does not fit in the registers
+static int get_ur_num(const GemmDynMStaticParam& static_param, int oc_num) {
+    // oc_num:               1  2  3  4
+    static int ur_table[] = {8, 8, 8, 6};
+    auto& blocking = static_param.blocking;
+    if (!blocking.ur_num)
+        return ur_table[oc_num - 1];
+    // weights, results and the broadcast a
+    if (blocking.ur_num < 1 || oc_num * (blocking.ur_num + 1) + 1 > 32)
+        return 0;
+    return blocking.ur_num;
+}
+
+// register blocks whose rows of A share a page run interleaved
+static int get_m_group(const GemmDynMStaticParam& static_param) {
+    if (static_param.blocking.m_group > 0)
+        return static_param.blocking.m_group;
+    size_t lda = static_param.lda / sizeof(float);
+    if (lda < 128) return 16;
+    if (lda < 256) return 8;
+    if (lda < 512) return 4;
+    if (lda < 1024) return 2;
+    return 1;
+}
+
+template <unsigned width>
+static GemmPrefetchParam resolve_prefetch(const GemmDynMStaticParam& static_param) {
+    auto& prefetch = static_param.prefetch;
+    int oc_num = (static_param.N + width - 1) / width;
+    int ur_num = get_ur_num(static_param, std::min(std::max(oc_num, 1), 4));
+    // u8 A: one quad of K per float
+    size_t K = static_param.a_type == dnnl_u8 ? (static_param.K + 3) / 4 : static_param.K;
+    size_t l1 = getDataCacheSize(1);
+    GemmPrefetchParam resolved;
+    // one row of A spans a page
+    resolved.a_dist = prefetch.a_dist ? std::max(prefetch.a_dist, 0) : (static_param.lda >= 4096 ? 4 : 0);
+    // the B panel does not fit in L1
+    resolved.b_dist = prefetch.b_dist ? std::max(prefetch.b_dist, 0) :
+        (K * oc_num * width * sizeof(float) > l1 ? 1 : 0);
+    // the C lines of an m group of register blocks do not fit in L1; scattered or skipped C has no lines
+    // to prefetch and streamed C bypasses the cache, prefetchw would only pull the lines back in
+    bool c_default = static_cast<size_t>(ur_num) * get_m_group(static_param) * static_param.ldc > l1;
+    bool prefetch_c = prefetch.c ? prefetch.c > 0 : c_default;
+    resolved.c = prefetch_c && static_param.c_store_mode == CStoreMode::Normal && !static_param.row_reduce.skip_c &&
+        !static_param.c_stream;
+    return resolved;
+}
+
+GemmPrefetchParam get_prefetch(const GemmDynMStaticParam& static_param) {
+    return resolve_prefetch<16>(static_param);
+}
+
+using func_t = gemm_func_t;
 template <unsigned width>
-static func_t make_gemm_stride(int N, int K, int lda, int ldb, int ldc, PostOpStaticParams post_static_params) {
+static func_t make_gemm_stride(const GemmDynMStaticParam& static_param, const float* b_packed = nullptr) {
+    int N = static_param.N, K = static_param.K;
+    int lda = static_param.lda, ldb = static_param.ldb, ldc = static_param.ldc;
+    PostOpStaticParams post_static_params = static_param.post_static_params;
     auto fn = coat::createFunction<func_t>("brgemm");
     if constexpr (width == 16)
         fn.funcNode->frame().setAvx512Enabled();
@@ -196,9 +251,51 @@ static func_t make_gemm_stride(int N, int K, int lda, int ldb, int ldc, PostOpSt
         std::cout << "oc_num must be in [1, 64]" << std::endl;
         return nullptr;
     }
-    // oc_num:               1  2  3  4
-    static int ur_table[] = {8, 8, 8, 6};
-    int ur_num = ur_table[oc_num - 1];
+    auto& row_reduce = static_param.row_reduce;
+    bool reduce_row = row_reduce.alg != RowReduceAlg::None;
+    if (reduce_row && static_param.c_store_mode != CStoreMode::Normal) {
+        std::cout << "row reduction does not support scattered C" << std::endl;
+        return nullptr;
+    }
+    if (static_param.row_norm.alg != RowNormAlg::None && (reduce_row || static_param.c_store_mode != CStoreMode::Normal)) {
+        std::cout << "row normalization does not support row reduction or scattered C" << std::endl;
+        return nullptr;
+    }
+    if (row_reduce.alg == RowReduceAlg::TopK && (row_reduce.k <= 0 || row_reduce.k > MAX_ROW_REDUCE_K || row_reduce.k > N)) {
+        std::cout << "top k must be in [1, min(N, " << MAX_ROW_REDUCE_K << ")]" << std::endl;
+        return nullptr;
+    }
+    if (static_param.c_stream && (static_param.c_store_mode != CStoreMode::Normal || static_param.ldc % 64)) {
+        std::cout << "streaming C needs normal C store and ldc aligned to 64 bytes" << std::endl;
+        return nullptr;
+    }
+    if (static_param.aligned && (static_param.ldb % 64 || static_param.ldc % 64)) {
+        std::cout << "aligned kernel needs ldb and ldc aligned to 64 bytes" << std::endl;
+        return nullptr;
+    }
+    bool sparse_b = static_param.b_sparse.block_mask || static_param.b_sparse.b;
+    if (sparse_b && width != 16) {
+        std::cout << "block sparse B needs 16 floats per vector" << std::endl;
+        return nullptr;
+    }
+    if (sparse_b && static_param.skip_zero_a) {
+        std::cout << "block sparse B does not support skipping zero A" << std::endl;
+        return nullptr;
+    }
+    // u8 A and s8 B: vpdpbusd on quads of K, the s32 sums are dequantized before the post ops
+    bool quant_a = static_param.a_type == dnnl_u8;
+    if (quant_a && (width != 16 || sparse_b || static_param.skip_zero_a)) {
+        std::cout << "u8 A needs 16 lanes per vector and no block sparse B or zero A skipping" << std::endl;
+        return nullptr;
+    }
+    // u8 A: K counts the quads from here on, one quad takes the place of one float
+    if (quant_a)
+        K = (K + 3) / 4;
+    int ur_num = get_ur_num(static_param, oc_num);
+    if (!ur_num) {
+        std::cout << "ur_num " << static_param.blocking.ur_num << " does not fit in the registers for N " << N << std::endl;
+        return nullptr;
+    }
     {
         bool has_n_tail = (N % width) != 0;
         if (has_n_tail) {
@@ -212,150 +309,586 @@ static func_t make_gemm_stride(int N, int K, int lda, int ldb, int ldc, PostOpSt
         auto j_a = j_a_.cast<float>();
         auto j_b = j_b_.cast<float>();
         auto j_c = j_c_.cast<float>();
-        std::vector<share_vec<width>> j_weight(oc_num);
-        std::vector<share_vec<width>> j_result;
-        for (int i = 0; i < oc_num; i++) {
-            j_weight[i] = std::make_shared<coat::Vec<float, width>>();
+        jit_gemm_block<width> block(ur_num, oc_num, has_n_tail);
+        auto& j_weight = block.weight;
+        auto& j_result = block.result;
+        auto& j_data = block.data;
+
+        // scattered C: row m goes to c[c_row_index[m]] scaled by c_row_scale[m], j_c stays at the base
+        bool scatter_c = static_param.c_store_mode != CStoreMode::Normal;
+        int ldc_scatter = ldc;
+        coat::Ptr<coat::Value<int>> j_row_index;
+        coat::Ptr<coat::Value<float>> j_row_scale;
+        if (scatter_c) {
+            j_row_index = j_post_runtime_params.get_value<PostOpRuntimeParams::member_c_row_index>("row_index");
+            j_row_scale = j_post_runtime_params.get_value<PostOpRuntimeParams::member_c_row_scale>("row_scale");
         }
-        for (int i = 0; i < oc_num * ur_num; i++) {
-            j_result.push_back(std::make_shared<coat::Vec<float, width>>());
+        // row reduction: row m goes to row_reduce_val/idx[m * reduce_ld]
+        int reduce_slots = get_row_reduce_slots(row_reduce);
+        int reduce_ld = row_reduce.ld ? row_reduce.ld : reduce_slots;
+        coat::Ptr<coat::Value<float>> j_reduce_val;
+        coat::Ptr<coat::Value<int>> j_reduce_idx;
+        if (reduce_row) {
+            j_reduce_val = j_post_runtime_params.get_value<PostOpRuntimeParams::member_row_reduce_val>("reduce_val");
+            if (row_reduce.alg == RowReduceAlg::ArgMax || row_reduce.alg == RowReduceAlg::TopK)
+                j_reduce_idx = j_post_runtime_params.get_value<PostOpRuntimeParams::member_row_reduce_idx>("reduce_idx");
+        }
+        bool per_element = false;
+        for (auto i = 0; i < post_static_params.num; i++) {
+            per_element |= post_static_params.ops[i].alg_type >= AlgType::Add &&
+                post_static_params.ops[i].binary_param.layout == BinaryDataLayout::PerElement;
+        }
+        bool need_row = scatter_c || reduce_row || per_element || quant_a;
+        coat::Ptr<coat::Value<float>> j_a_scale, j_b_scale, j_b_comp;
+        if (quant_a) {
+            j_a_scale = j_post_runtime_params.get_value<PostOpRuntimeParams::member_a_scale>("a_scale");
+            j_b_scale = j_post_runtime_params.get_value<PostOpRuntimeParams::member_b_scale>("b_scale");
+            j_b_comp = j_post_runtime_params.get_value<PostOpRuntimeParams::member_b_comp>("b_comp").cast<float>();
+        }
+        // layer norm/rms norm: gamma and beta, N is the whole row
+        auto norm_alg = static_param.row_norm.alg;
+        coat::Ptr<coat::Value<float>> j_gamma, j_beta;
+        if (norm_alg == RowNormAlg::LayerNorm || norm_alg == RowNormAlg::RMSNorm) {
+            j_gamma = j_post_runtime_params.get_value<PostOpRuntimeParams::member_norm_gamma>("gamma");
+            if (norm_alg == RowNormAlg::LayerNorm)
+                j_beta = j_post_runtime_params.get_value<PostOpRuntimeParams::member_norm_beta>("beta");
         }
-        coat::Vec<float, width> j_data;
 
         // postops
-        PostOpInjectParams inject_postops_param;
-        using share_p = std::shared_ptr<coat::Ptr<coat::Value<float>>>;
-        std::vector<share_p> post_ops_runtime_addrs;
-        // extract all second address from parameter 'ops' of jit func
-        for (auto i = 0; i < post_static_params.num; i++) {
-            if (post_static_params.ops[i].alg_type >= AlgType::Add) {
-                auto params = j_post_runtime_params.get_value<PostOpRuntimeParams::member_params>("params");
-                auto addr = params[i].get_value<PostOpRuntimeParam::member_right_addr>("addr");
-                // TODO: ptr has no 'operator= addr'
-                auto op = std::make_shared<share_p::element_type>(addr);
-                post_ops_runtime_addrs.push_back(op);
-            } else {
-                auto op = std::make_shared<share_p::element_type>();
-                // no need, just a placeholder
-                post_ops_runtime_addrs.push_back(op);
+        PostOpBinaryAddrs<width> post_ops(post_static_params, j_post_runtime_params, static_param.ldc);
+        // several lines fall in one page
+        int m_group = get_m_group(static_param);
+        // software prefetch, the distances are in k loop iterations
+        auto prefetch = resolve_prefetch<width>(static_param);
+        int a_dist = prefetch.a_dist;
+        int b_dist = prefetch.b_dist;
+        bool prefetch_c = prefetch.c;
+        auto prefetch_k = [&] (int ur_num, int oc_num, coat::wrapper_type<float*>& j_a, coat::wrapper_type<float*>& j_b,
+            int lda, int ldb) {
+            for (int m = 0; m < ur_num && a_dist; m++)
+                _CC.prefetcht0(j_a[m * lda + a_dist * width]);
+            for (int j = 0; j < static_cast<int>(width) && b_dist; j++) {
+                for (int n = 0; n < oc_num; n++)
+                    _CC.prefetcht0(j_b[(b_dist * width + j) * ldb + n * width]);
             }
-        }
-        // compute all address for binary ops
-        auto prepare_inject_param = [&] (int ur_num, int oc_num) {
-            for (auto i = 0; i < post_static_params.num; i++) {
-                if (post_static_params.ops[i].alg_type >= AlgType::Add && post_static_params.ops[i].binary_param.layout != BinaryDataLayout::PerTensor) {
-                    auto& ptr = *post_ops_runtime_addrs[i];
-                    inject_postops_param.params[i].right_addrs_offset.clear();
-                    inject_postops_param.params[i].layout = post_static_params.ops[i].binary_param.layout;
-                    inject_postops_param.params[i].right_addrs_base.reg = ptr.reg;
-                    for (int j = 0; j < ur_num; j++)
-                        for (int k = 0; k < oc_num; k++)
-                            inject_postops_param.params[i].right_addrs_offset.push_back(k * width);
-                }
+        };
+        // the lines save_post writes, they arrive during the k loop
+        auto prefetch_c_lines = [&] (int ur_num, int oc_num, coat::wrapper_type<float*>& j_c, int ldc) {
+            for (int m = 0; m < ur_num && prefetch_c; m++) {
+                for (int n = 0; n < oc_num; n++)
+                    _CC.prefetchw(j_c[m * ldc + n * width]);
             }
         };
-        // several lines fall in one page
-        int m_group = 1;
-        if (lda < 128) m_group = 16;
-        else if (lda < 256) m_group = 8;
-        else if (lda < 512) m_group = 4;
-        else if (lda < 1024) m_group = 2;
+        // aligned: rows of B and C start on a cache line, the full vectors use the aligned forms
+        bool aligned = static_param.aligned;
+        auto load_b = [aligned] (coat::Vec<float, width>& vec, asmjit::x86::Mem mem) {
+            mem.setSize(width * sizeof(float));
+            if (aligned)
+                _CC.vmovaps(vec.reg, mem);
+            else
+                _CC.vmovups(vec.reg, mem);
+        };
+        auto store_c = [aligned] (coat::Vec<float, width>& vec, asmjit::x86::Mem mem) {
+            mem.setSize(width * sizeof(float));
+            if (aligned)
+                _CC.vmovaps(mem, vec.reg);
+            else
+                _CC.vmovups(mem, vec.reg);
+        };
         coat::Value<int> j_m(int(0), "m");
-        auto fma = [&has_n_tail, &j_weight, &j_data, &j_result](int ur_num, int k_num, int oc_num,
+        auto fma = [&block, &quant_a, &load_b](int ur_num, int k_num,
             coat::wrapper_type<float*>& j_a, coat::wrapper_type<float*>& j_b,
             int lda, int ldb) {
-            for (int j = 0; j < k_num; j++) {
+            block.fma(ur_num, k_num, j_a, j_b, lda, ldb, load_b, quant_a);
+        };
+        // u8 A: the sums start at -b_comp, which removes the 128 added to A
+        auto init_result = [&] (int ur_num, int oc_num) {
+            for (int m = 0; m < ur_num; m++) {
+                for (int n = 0; n < oc_num; n++) {
+                    auto& vec = *j_result[m * oc_num + n];
+                    vec = 0;
+                    if (!quant_a)
+                        continue;
+                    if (has_n_tail && n == oc_num - 1)
+                        j_data.kzload(j_b_comp[n * width], asmjit::x86::k1);
+                    else
+                        j_data.load(j_b_comp[n * width]);
+                    _CC.vpsubd(vec.reg, vec.reg, j_data.reg);
+                }
+            }
+        };
+        // zero A: one bit per k of the block which is nonzero in any of the ur rows, dense blocks
+        // go to fma, sparse ones only visit the set bits
+        auto fma_skip_zero_a = [&] (int ur_num, int oc_num, coat::wrapper_type<float*>& j_a, coat::wrapper_type<float*>& j_b,
+            int lda, int ldb) {
+            coat::Mask j_nonzero("nonzero"), j_row_nonzero("row_nonzero");
+            coat::Value<int> j_bits("bits"), j_next("next"), j_pos("pos");
+            coat::Value<int64_t> j_k("k"), j_b_offset("b_offset");
+            *j_weight[0] = 0; // zero to compare with, reloaded below
+            for (int m = 0; m < ur_num; m++) {
+                j_data.load(j_a[m * lda]);
+                _CC.vcmpps(m ? j_row_nonzero.reg : j_nonzero.reg, j_data.reg, j_weight[0]->reg, 4); // _CMP_NEQ_UQ
+                if (m)
+                    _CC.korw(j_nonzero.reg, j_nonzero.reg, j_row_nonzero.reg);
+            }
+            _CC.kmovw(j_bits.reg, j_nonzero.reg);
+            asmjit::Label L_End = _CC.newLabel();
+            coat::if_then(j_bits == 0xffff, [&] {
+                fma(ur_num, width, j_a, j_b, lda, ldb);
+                _CC.jmp(L_End);
+            });
+            coat::loop_while(j_bits != 0, [&] {
+                _CC.tzcnt(j_pos.reg, j_bits.reg);
+                // clear the lowest set bit
+                j_next = j_bits;
+                j_next -= 1;
+                j_bits &= j_next;
+                j_k.widen(j_pos);
+                j_b_offset = j_k;
+                j_b_offset *= ldb;
                 for (int n = 0; n < oc_num - has_n_tail; n++) {
-                    j_weight[n]->load(j_b[j * ldb + n * width]);
+                    load_b(*j_weight[n], j_b.index(j_b_offset, sizeof(float), n * width * sizeof(float)));
                 }
                 if (has_n_tail) {
-                    j_weight[oc_num - 1]->kzload(j_b[j * ldb + (oc_num - 1) * width], asmjit::x86::k1);
+                    j_weight[oc_num - 1]->kzload(j_b.index(j_b_offset, sizeof(float), (oc_num - 1) * width * sizeof(float)), asmjit::x86::k1);
                 }
                 for (int m = 0; m < ur_num; m++) {
-                    j_data.load(j_a[m * lda + j], true);
+                    j_data.load(j_a.index(j_k, sizeof(float), m * lda * sizeof(float)), true);
                     for (int n = 0; n < oc_num; n++) {
                         j_result[m * oc_num + n]->fma231(*j_weight[n], j_data);
                     }
                 }
+            });
+            _CC.bind(L_End);
+        };
+        // block sparse B: K is fully unrolled, only the nonzero blocks are loaded and multiplied
+        std::vector<uint8_t> b_block_mask;
+        std::shared_ptr<coat::Ptr<coat::Value<float>>> j_b_packed;
+        if (sparse_b) {
+            b_block_mask = get_b_block_mask(static_param);
+            if (b_packed)
+                j_b_packed = std::make_shared<coat::Ptr<coat::Value<float>>>(b_packed, "b_packed");
+        }
+        auto sparse_fma = [&] (int ur_num, int oc_num, coat::wrapper_type<float*>& j_a, int lda) {
+            int k_blocks = (K + width - 1) / width;
+            int packed_offset = 0;
+            for (int kb = 0; kb < k_blocks; kb++) {
+                std::vector<int> nonzero;
+                for (int n = 0; n < oc_num; n++) {
+                    if (b_block_mask[kb * oc_num + n])
+                        nonzero.push_back(n);
+                }
+                if (nonzero.empty())
+                    continue;
+                int k_num = std::min(static_cast<int>(width), K - kb * static_cast<int>(width));
+                for (int j = 0; j < k_num; j++) {
+                    int k = kb * width + j;
+                    for (size_t i = 0; i < nonzero.size(); i++) {
+                        auto n = nonzero[i];
+                        if (j_b_packed)
+                            j_weight[n]->load((*j_b_packed)[packed_offset + static_cast<int>(i * width * width) + j * width]);
+                        else if (has_n_tail && n == oc_num - 1)
+                            j_weight[n]->kzload(j_b[k * ldb + n * width], asmjit::x86::k1);
+                        else
+                            j_weight[n]->load(j_b[k * ldb + n * width]);
+                    }
+                    for (int m = 0; m < ur_num; m++) {
+                        j_data.load(j_a[m * lda + k], true);
+                        for (auto n : nonzero)
+                            j_result[m * oc_num + n]->fma231(*j_weight[n], j_data);
+                    }
+                }
+                packed_offset += static_cast<int>(nonzero.size() * width * width);
             }
         };
-        auto save_post = [&] (int ur_num, int oc_num, bool has_n_tail, int ldc, coat::wrapper_type<float *>& j_c) {
-            prepare_inject_param(ur_num, oc_num);
-            inject_postops<width>(ur_num * oc_num, j_result, post_static_params, inject_postops_param);
+        // j_row: index of the first row of the ur block, row_stride: distance between the ur rows
+        auto save_scatter = [&] (int ur_num, int oc_num, bool has_n_tail, coat::wrapper_type<float *>& j_c,
+            coat::Value<int64_t>& j_row, int row_stride) {
+            coat::Value<int64_t> j_offset("c_offset");
+            coat::Vec<float, width> j_scale, j_old;
             for (int m = 0; m < ur_num; m++) {
-                for (int n = 0; n < oc_num - has_n_tail; n++) {
-                    j_result[m * oc_num + n]->store(j_c[m * ldc + n * width]);
+                j_offset.widen(j_row_index.index(j_row, m * row_stride * sizeof(int)));
+                j_offset *= ldc_scatter;
+                j_scale.load(j_row_scale.index(j_row, m * row_stride * sizeof(float)), true);
+                for (int n = 0; n < oc_num; n++) {
+                    auto& vec = *j_result[m * oc_num + n];
+                    bool is_tail = has_n_tail && n == oc_num - 1;
+                    vec.mul(j_scale);
+                    if (static_param.c_store_mode == CStoreMode::ScatterAccumulate) {
+                        if (is_tail) {
+                            j_old.kzload(j_c.index(j_offset, sizeof(float), n * width * sizeof(float)), asmjit::x86::k1);
+                            vec.add(j_old);
+                        } else {
+                            vec.add(j_c.index(j_offset, sizeof(float), n * width * sizeof(float)));
+                        }
+                    }
+                    if (is_tail)
+                        vec.kstore(j_c.index(j_offset, sizeof(float), n * width * sizeof(float)), asmjit::x86::k1);
+                    else
+                        vec.store(j_c.index(j_offset, sizeof(float), n * width * sizeof(float)));
                 }
-                if (has_n_tail) {
-                    j_result[m * oc_num + oc_num - 1]->kstore(j_c[m * ldc + (oc_num - 1) * width], asmjit::x86::k1);
+            }
+        };
+        // j_acc = max/sum of one row held in oc_num vecs, broadcast to all lanes
+        auto reduce_vecs = [&] (auto vecs, int oc_num, coat::Vec<float, width>& j_acc, bool is_max) {
+            j_acc = *vecs[0];
+            for (int n = 1; n < oc_num; n++) {
+                if (is_max)
+                    j_acc.max_(*vecs[n]);
+                else
+                    j_acc.add(*vecs[n]);
+            }
+            jit_reduce<width>(j_acc, is_max);
+        };
+        // lanes beyond N must not take part in a row reduction: j_lowest for max, zero for sum
+        auto mask_tail = [&] (coat::Vec<float, width>& tail, coat::Vec<float, width>* j_lowest) {
+            if (j_lowest)
+                _CC.k(asmjit::x86::k1).vblendmps(tail.reg, j_lowest->reg, tail.reg);
+            else
+                _CC.k(asmjit::x86::k1).z().vmovaps(tail.reg, tail.reg);
+        };
+        // layer norm/rms norm in place, N is the whole row
+        auto norm_row_moments = [&] (int ur_num, int oc_num, bool has_n_tail) {
+            coat::Vec<float, width> j_mean, j_sum, j_tmp, j_inv_n;
+            j_inv_n = 1.0f / N;
+            for (int m = 0; m < ur_num; m++) {
+                auto vecs = j_result.begin() + m * oc_num;
+                if (has_n_tail)
+                    mask_tail(*vecs[oc_num - 1], nullptr);
+                if (norm_alg == RowNormAlg::LayerNorm) {
+                    reduce_vecs(vecs, oc_num, j_mean, false);
+                    j_mean.mul(j_inv_n);
+                    for (int n = 0; n < oc_num; n++)
+                        vecs[n]->sub(j_mean);
+                    if (has_n_tail)
+                        mask_tail(*vecs[oc_num - 1], nullptr);
+                }
+                j_sum = 0;
+                for (int n = 0; n < oc_num; n++)
+                    j_sum.fma231(*vecs[n], *vecs[n]);
+                jit_reduce<width>(j_sum, false);
+                j_sum.mul(j_inv_n);
+                j_tmp = static_param.row_norm.eps;
+                j_sum.add(j_tmp);
+                _CC.vsqrtps(j_sum.reg, j_sum.reg);
+                j_tmp = 1.0f;
+                j_tmp.div(j_sum);
+                for (int n = 0; n < oc_num; n++) {
+                    vecs[n]->mul(j_tmp);
+                    if (has_n_tail && n == oc_num - 1) {
+                        j_sum.kzload(j_gamma[n * width], asmjit::x86::k1);
+                        vecs[n]->mul(j_sum);
+                        if (norm_alg == RowNormAlg::LayerNorm) {
+                            j_sum.kzload(j_beta[n * width], asmjit::x86::k1);
+                            vecs[n]->add(j_sum);
+                        }
+                    } else {
+                        vecs[n]->mul(j_gamma[n * width]);
+                        if (norm_alg == RowNormAlg::LayerNorm)
+                            vecs[n]->add(j_beta[n * width]);
+                    }
                 }
             }
         };
-        auto j_M_block = j_M;
-        j_M_block %= (ur_num * m_group);
-        j_M_block = j_M - j_M_block;
-        //for (m = 0; m < M; m += 8) {
-        coat::for_loop(j_m < j_M_block,
-        [&] {
-            j_m += ur_num * m_group;
-            j_a += ur_num * lda * m_group;
-            j_c += ur_num * ldc * m_group;
-        },
-        [&] {
-            coat::Value<int> j_sub_m(int(0), "sub_m");
-            auto j_aa = j_a; // a ptr inside a group
-            auto j_cc = j_c;
-            //for (int sub_m = 0; sub_m < m_group; sub_m++) {
-            coat::for_loop(j_sub_m < m_group,
+        // softmax/log softmax in place, N is the whole row
+        auto norm_row = [&] (int ur_num, int oc_num, bool has_n_tail) {
+            auto alg = norm_alg;
+            if (alg == RowNormAlg::LayerNorm || alg == RowNormAlg::RMSNorm) {
+                norm_row_moments(ur_num, oc_num, has_n_tail);
+                return;
+            }
+            coat::Vec<float, width> j_max, j_sum, j_tmp, j_lowest;
+            j_lowest = -std::numeric_limits<float>::infinity();
+            for (int m = 0; m < ur_num; m++) {
+                auto vecs = j_result.begin() + m * oc_num;
+                if (has_n_tail)
+                    mask_tail(*vecs[oc_num - 1], &j_lowest);
+                reduce_vecs(vecs, oc_num, j_max, true);
+                j_sum = 0;
+                for (int n = 0; n < oc_num; n++) {
+                    vecs[n]->sub(j_max);
+                    auto& j_exp = alg == RowNormAlg::Softmax ? *vecs[n] : j_tmp;
+                    if (alg != RowNormAlg::Softmax)
+                        j_tmp = *vecs[n];
+                    jit_exp<width>(j_exp);
+                    if (has_n_tail && n == oc_num - 1)
+                        mask_tail(j_exp, nullptr);
+                    j_sum.add(j_exp);
+                }
+                jit_reduce<width>(j_sum, false);
+                if (alg == RowNormAlg::Softmax) {
+                    j_tmp = 1.0f;
+                    j_tmp.div(j_sum);
+                    for (int n = 0; n < oc_num; n++)
+                        vecs[n]->mul(j_tmp);
+                } else {
+                    jit_log<width>(j_sum);
+                    for (int n = 0; n < oc_num; n++)
+                        vecs[n]->sub(j_sum);
+                }
+            }
+        };
+        // reduce the rows, destroys j_result
+        auto save_reduce = [&] (int ur_num, int oc_num, bool has_n_tail, coat::Value<int64_t>& j_row, int row_stride) {
+            auto alg = row_reduce.alg;
+            coat::Value<int64_t> j_offset("reduce_offset");
+            coat::Value<int> j_idx("reduce_idx"), j_pos("reduce_pos"), j_bits("reduce_bits");
+            coat::Vec<float, width> j_acc, j_sum, j_lowest;
+            coat::Mask j_eq("eq");
+            j_offset = j_row;
+            j_offset *= reduce_ld;
+            j_lowest = -std::numeric_limits<float>::infinity();
+            for (int m = 0; m < ur_num; m++) {
+                auto vecs = j_result.begin() + m * oc_num;
+                int disp = m * row_stride * reduce_ld;
+                auto val = [&] (int slot) {
+                    return j_reduce_val.index(j_offset, sizeof(float), (disp + slot) * sizeof(float));
+                };
+                auto idx = [&] (int slot) {
+                    return j_reduce_idx.index(j_offset, sizeof(int), (disp + slot) * sizeof(int));
+                };
+                bool zero_tail = alg == RowReduceAlg::Sum || alg == RowReduceAlg::Moments || alg == RowReduceAlg::SumSquare;
+                if (has_n_tail)
+                    mask_tail(*vecs[oc_num - 1], zero_tail ? nullptr : &j_lowest);
+                auto reduce_all = [&] (bool is_max) {
+                    reduce_vecs(vecs, oc_num, j_acc, is_max);
+                };
+                // first column holding the value broadcast in j_acc
+                auto find_column = [&] {
+                    j_idx = 0;
+                    for (int n = oc_num - 1; n >= 0; n--) {
+                        _CC.vcmpps(j_eq.reg, vecs[n]->reg, j_acc.reg, 0); // _CMP_EQ_OQ
+                        _CC.kmovw(j_bits.reg, j_eq.reg);
+                        _CC.tzcnt(j_pos.reg, j_bits.reg);
+                        j_pos += n * width;
+                        _CC.test(j_bits.reg, j_bits.reg);
+                        _CC.cmovne(j_idx.reg, j_pos.reg);
+                    }
+                };
+                switch (alg) {
+                    case RowReduceAlg::Sum:
+                    case RowReduceAlg::Max:
+                        reduce_all(alg == RowReduceAlg::Max);
+                        _CC.vmovss(val(0), j_acc.reg.xmm());
+                        break;
+                    case RowReduceAlg::ArgMax:
+                    case RowReduceAlg::TopK: {
+                        int k = alg == RowReduceAlg::TopK ? row_reduce.k : 1;
+                        auto lanes = _CC.newConst(asmjit::ConstPoolScope::kLocal, lane_index, sizeof(lane_index));
+                        for (int r = 0; r < k; r++) {
+                            reduce_all(true);
+                            find_column();
+                            _CC.vmovss(val(r), j_acc.reg.xmm());
+                            idx(r) = j_idx;
+                            if (r + 1 == k)
+                                break;
+                            // drop the column just found
+                            _CC.vpbroadcastd(j_sum.reg, j_idx.reg);
+                            for (int n = 0; n < oc_num; n++) {
+                                auto lane = lanes;
+                                lane.addOffset(n * width * sizeof(int));
+                                _CC.vpcmpeqd(j_eq.reg, j_sum.reg, lane);
+                                _CC.k(j_eq.reg).vmovaps(vecs[n]->reg, j_lowest.reg);
+                            }
+                        }
+                        break;
+                    }
+                    case RowReduceAlg::LogSumExp:
+                        reduce_all(true);
+                        _CC.vmovss(val(0), j_acc.reg.xmm());
+                        j_sum = 0;
+                        for (int n = 0; n < oc_num; n++) {
+                            vecs[n]->sub(j_acc);
+                            jit_exp<width>(*vecs[n]);
+                            if (has_n_tail && n == oc_num - 1)
+                                mask_tail(*vecs[n], nullptr);
+                            j_sum.add(*vecs[n]);
+                        }
+                        jit_reduce<width>(j_sum, false);
+                        _CC.vmovss(val(1), j_sum.reg.xmm());
+                        break;
+                    case RowReduceAlg::Moments:
+                        // mean and variance of this block, matmul merges the blocks with Chan's formula
+                        reduce_all(false);
+                        j_sum = 1.0f / N;
+                        j_acc.mul(j_sum);
+                        _CC.vmovss(val(0), j_acc.reg.xmm());
+                        for (int n = 0; n < oc_num; n++)
+                            vecs[n]->sub(j_acc);
+                        if (has_n_tail)
+                            mask_tail(*vecs[oc_num - 1], nullptr);
+                        j_acc = 0;
+                        for (int n = 0; n < oc_num; n++)
+                            j_acc.fma231(*vecs[n], *vecs[n]);
+                        jit_reduce<width>(j_acc, false);
+                        j_acc.mul(j_sum);
+                        _CC.vmovss(val(1), j_acc.reg.xmm());
+                        break;
+                    case RowReduceAlg::SumSquare:
+                        j_acc = 0;
+                        for (int n = 0; n < oc_num; n++)
+                            j_acc.fma231(*vecs[n], *vecs[n]);
+                        jit_reduce<width>(j_acc, false);
+                        _CC.vmovss(val(0), j_acc.reg.xmm());
+                        break;
+                    default:
+                        break;
+                }
+            }
+        };
+        // u8 A: s32 sums to float scaled by a_scale of the row and b_scale of the column
+        auto dequant = [&] (int ur_num, int oc_num, bool has_n_tail, coat::Value<int64_t>& j_row, int row_stride) {
+            coat::Vec<float, width> j_scale, j_tmp;
+            for (int m = 0; m < ur_num; m++) {
+                j_scale.load(j_a_scale.index(j_row, m * row_stride * sizeof(float)), true);
+                for (int n = 0; n < oc_num; n++) {
+                    auto& vec = *j_result[m * oc_num + n];
+                    _CC.vcvtdq2ps(vec.reg, vec.reg);
+                    vec.mul(j_scale);
+                    if (has_n_tail && n == oc_num - 1) {
+                        j_tmp.kzload(j_b_scale[n * width], asmjit::x86::k1);
+                        vec.mul(j_tmp);
+                    } else {
+                        vec.mul(j_b_scale[n * width]);
+                    }
+                }
+            }
+        };
+        auto save_post = [&] (int ur_num, int oc_num, bool has_n_tail, int ldc, coat::wrapper_type<float *>& j_c,
+            coat::Value<int64_t>& j_row, int row_stride) {
+            if (quant_a)
+                dequant(ur_num, oc_num, has_n_tail, j_row, row_stride);
+            post_ops.apply(ur_num, oc_num, has_n_tail, j_result, &j_row, row_stride);
+            if (static_param.row_norm.alg != RowNormAlg::None)
+                norm_row(ur_num, oc_num, has_n_tail);
+            if (scatter_c) {
+                save_scatter(ur_num, oc_num, has_n_tail, j_c, j_row, row_stride);
+                return;
+            }
+            if (!row_reduce.skip_c) {
+                block.store(ur_num, j_c, ldc, [&] (coat::Vec<float, width>& vec, asmjit::x86::Mem mem) {
+                    if (static_param.c_stream)
+                        _CC.vmovntps(mem, vec.reg);
+                    else
+                        store_c(vec, mem);
+                });
+            }
+            if (reduce_row)
+                save_reduce(ur_num, oc_num, has_n_tail, j_row, row_stride);
+        };
+        // rows [j_m, end) in groups of ur_num * m_group
+        auto group_loop = [&] (auto& end) {
+            //for (m = 0; m < M; m += 8) {
+            coat::for_loop(j_m < end,
             [&] {
-                j_sub_m += 1;
-                j_aa += lda;
-                j_cc += ldc;
+                j_m += ur_num * m_group;
+                j_a += ur_num * lda * m_group;
+                if (!scatter_c)
+                    j_c += ur_num * ldc * m_group;
             },
             [&] {
-                for (int i = 0; i < oc_num * ur_num; i++) {
-                    (*j_result[i]) = 0;
-                }
-                coat::Value<int> j_k(int(0), "k");
-                auto j_b_row = j_b;
-                auto j_a_row = j_aa;
-                //for (k = 0; k < K; k += width) {
-                coat::for_loop(j_k < K / width * width,
-                    [&] {
-                        j_k += width;
-                        j_b_row += width * ldb;
-                        j_a_row += width;
-                    },
-                    [&] {
-                        fma(ur_num, width, oc_num, j_a_row, j_b_row, lda * m_group, ldb);
-                    });
-                // K tail
-                if (K % width != 0)
-                    fma(ur_num, K % width, oc_num, j_a_row, j_b_row, lda * m_group, ldb);
-                save_post(ur_num, oc_num, has_n_tail, ldc * m_group, j_cc);
+                coat::Value<int> j_sub_m(int(0), "sub_m");
+                auto j_aa = j_a; // a ptr inside a group
+                auto j_cc = j_c;
+                //for (int sub_m = 0; sub_m < m_group; sub_m++) {
+                coat::for_loop(j_sub_m < m_group,
+                [&] {
+                    j_sub_m += 1;
+                    j_aa += lda;
+                    if (!scatter_c)
+                        j_cc += ldc;
+                },
+                [&] {
+                    init_result(ur_num, oc_num);
+                    prefetch_c_lines(ur_num, oc_num, j_cc, ldc * m_group);
+                    if (sparse_b) {
+                        sparse_fma(ur_num, oc_num, j_aa, lda * m_group);
+                    } else {
+                        coat::Value<int> j_k(int(0), "k");
+                        auto j_b_row = j_b;
+                        auto j_a_row = j_aa;
+                        //for (k = 0; k < K; k += width) {
+                        coat::for_loop(j_k < K / width * width,
+                            [&] {
+                                j_k += width;
+                                j_b_row += width * ldb;
+                                j_a_row += width;
+                            },
+                            [&] {
+                                prefetch_k(ur_num, oc_num, j_a_row, j_b_row, lda * m_group, ldb);
+                                if (static_param.skip_zero_a)
+                                    fma_skip_zero_a(ur_num, oc_num, j_a_row, j_b_row, lda * m_group, ldb);
+                                else
+                                    fma(ur_num, width, j_a_row, j_b_row, lda * m_group, ldb);
+                            });
+                        // K tail
+                        if (K % width != 0)
+                            fma(ur_num, K % width, j_a_row, j_b_row, lda * m_group, ldb);
+                    }
+                    coat::Value<int64_t> j_row("row");
+                    if (need_row) {
+                        coat::Value<int64_t> j_row_sub("row_sub");
+                        j_row.widen(j_m);
+                        j_row_sub.widen(j_sub_m);
+                        j_row += j_row_sub;
+                    }
+                    save_post(ur_num, oc_num, has_n_tail, ldc * m_group, j_cc, j_row, m_group);
+                });
             });
-        });
- 
-        // M tail
-        coat::if_then(j_M_block != j_M, [&] {
-            auto j_M_block = j_M;
-            j_M_block /= ur_num;
-            j_M_block *= ur_num;
-            // tail: handle multiple of ur_num tail
+        };
+        // rows [j_m, end) in blocks of ur_num
+        auto ur_loop = [&] (auto& end) {
             //for (m = 0; m < M; m += 8) {
-            coat::for_loop(j_m < j_M_block,
+            coat::for_loop(j_m < end,
             [&] {
                 j_m += ur_num;
                 j_a += ur_num * lda;
-                j_c += ur_num * ldc;
+                if (!scatter_c)
+                    j_c += ur_num * ldc;
             },
             [&] {
-                for (int i = 0; i < oc_num * ur_num; i++) {
-                    (*j_result[i]) = 0;
+                init_result(ur_num, oc_num);
+                prefetch_c_lines(ur_num, oc_num, j_c, ldc);
+                if (sparse_b) {
+                    sparse_fma(ur_num, oc_num, j_a, lda);
+                } else {
+                    coat::Value<int> j_k(int(0), "k");
+                    auto j_b_row = j_b;
+                    auto j_a_row = j_a;
+                    //for (k = 0; k < K; k += width) {
+                    coat::for_loop(j_k < K / width * width,
+                        [&] {
+                            j_k += width;
+                            j_b_row += width * ldb;
+                            j_a_row += width;
+                        },
+                        [&] {
+                            prefetch_k(ur_num, oc_num, j_a_row, j_b_row, lda, ldb);
+                            if (static_param.skip_zero_a)
+                                fma_skip_zero_a(ur_num, oc_num, j_a_row, j_b_row, lda, ldb);
+                            else
+                                fma(ur_num, width, j_a_row, j_b_row, lda, ldb);
+                        });
+                    // K tail
+                    if (K % width != 0)
+                        fma(ur_num, K % width, j_a_row, j_b_row, lda, ldb);
                 }
-                coat::Value<int> j_k(int(0), "k");
-                auto j_b_row = j_b;
-                auto j_a_row = j_a;
+                coat::Value<int64_t> j_row("row");
+                if (need_row)
+                    j_row.widen(j_m);
+                save_post(ur_num, oc_num, has_n_tail, ldc, j_c, j_row, 1);
+            });
+        };
+        // the last rows, fewer than ur_num
+        auto unroll_n = [&] (int ur_num) {
+            init_result(ur_num, oc_num);
+            prefetch_c_lines(ur_num, oc_num, j_c, ldc);
+            coat::Value<int> j_k(int(0), "k");
+            auto j_b_row = j_b;
+            auto j_a_row = j_a;
+            if (sparse_b) {
+                sparse_fma(ur_num, oc_num, j_a, lda);
+            } else {
                 //for (k = 0; k < K; k += width) {
                 coat::for_loop(j_k < K / width * width,
                     [&] {
@@ -364,50 +897,64 @@ static func_t make_gemm_stride(int N, int K, int lda, int ldb, int ldc, PostOpSt
                         j_a_row += width;
                     },
                     [&] {
-                        fma(ur_num, width, oc_num, j_a_row, j_b_row, lda, ldb);
+                        prefetch_k(ur_num, oc_num, j_a_row, j_b_row, lda, ldb);
+                        if (static_param.skip_zero_a)
+                            fma_skip_zero_a(ur_num, oc_num, j_a_row, j_b_row, lda, ldb);
+                        else
+                            fma(ur_num, width, j_a_row, j_b_row, lda, ldb);
                     });
                 // K tail
                 if (K % width != 0)
-                    fma(ur_num, K % width, oc_num, j_a_row, j_b_row, lda, ldb);
-                save_post(ur_num, oc_num, has_n_tail, ldc, j_c);
-            });
-            // tail: handle not enough ur_num tail
-            // TODO: try jump table fma(7/6/5/.../1)
+                    fma(ur_num, K % width, j_a_row, j_b_row, lda, ldb);
+            }
+            coat::Value<int64_t> j_row("row");
+            if (need_row)
+                j_row.widen(j_m);
+            save_post(ur_num, oc_num, has_n_tail, ldc, j_c, j_row, 1);
+        };
+        if (static_param.fixed_m > 0) {
+            // every trip count is known, the remainder is emitted without dispatch
+            int fixed_m = static_param.fixed_m;
+            int group_end = fixed_m / (ur_num * m_group) * (ur_num * m_group);
+            int ur_end = fixed_m / ur_num * ur_num;
+            if (group_end > 0)
+                group_loop(group_end);
+            if (ur_end > group_end)
+                ur_loop(ur_end);
+            if (fixed_m > ur_end)
+                unroll_n(fixed_m - ur_end);
+        } else {
+            auto j_M_block = j_M;
+            j_M_block %= (ur_num * m_group);
+            j_M_block = j_M - j_M_block;
+            group_loop(j_M_block);
+
+            // M tail
             coat::if_then(j_M_block != j_M, [&] {
-                j_M -= j_M_block;
-                for (int i = 0; i < oc_num * ur_num; i++) {
-                    (*j_result[i]) = 0;
-                }
-                coat::Value<int> j_k(int(0), "k");
-                auto j_b_row = j_b;
-                auto j_a_row = j_a;
-                auto unroll_n = [&](int ur_num) {
-                    //for (k = 0; k < K; k += width) {
-                    coat::for_loop(j_k < K / width * width,
-                        [&] {
-                            j_k += width;
-                            j_b_row += width * ldb;
-                            j_a_row += width;
-                        },
-                        [&] {
-                            fma(ur_num, width, oc_num, j_a_row, j_b_row, lda, ldb);
+                auto j_M_block = j_M;
+                j_M_block /= ur_num;
+                j_M_block *= ur_num;
+                // tail: handle multiple of ur_num tail
+                ur_loop(j_M_block);
+                // tail: handle not enough ur_num tail
+                // TODO: try jump table fma(7/6/5/.../1)
+                coat::if_then(j_M_block != j_M, [&] {
+                    j_M -= j_M_block;
+                    asmjit::Label L_End = _CC.newLabel();
+                    for (int i = 1; i < ur_num; i++) {
+                        auto n = i;
+                        coat::if_then(j_M == n, [&] {
+                            unroll_n(n);
+                            _CC.jmp(L_End);
                         });
-                    // K tail
-                    if (K % width != 0)
-                        fma(ur_num, K % width, oc_num, j_a_row, j_b_row, lda, ldb);
-                    save_post(ur_num, oc_num, has_n_tail, ldc, j_c);
-                };
-                asmjit::Label L_End = _CC.newLabel();
-                for (int i = 1; i < ur_num; i++) {
-                    auto n = i;
-                    coat::if_then(j_M == n, [&] {
-                        unroll_n(n);
-                        _CC.jmp(L_End);
-                    });
-                }
-                _CC.bind(L_End);
+                    }
+                    _CC.bind(L_End);
+                });
             });
-        });
+        }
+        // non-temporal stores are weakly ordered, make them visible before returning
+        if (static_param.c_stream)
+            _CC.sfence();
         // specify return value
         coat::ret();
     }
@@ -420,15 +967,18 @@ static func_t make_gemm_stride(int N, int K, int lda, int ldb, int ldc, PostOpSt
 template <cpu_isa_t isa>
 struct gemm_kernel<isa>::gemm_kernel_impl {
     func_t _func;
+    // block sparse B packed at init, the jit code refers to it directly
+    std::vector<float> _b_packed;
     gemm_kernel_impl() : _func(nullptr) {
     }
     bool init(const GemmDynMStaticParam& static_param) {
+        if (static_param.b_sparse.b)
+            pack_b_blocks(static_param, _b_packed);
         if constexpr (static_cast<unsigned>(isa) & avx512_core_bit)
-            if (static_param.a_type == dnnl_f32 &&
-                static_param.b_type == dnnl_f32 &&
+            if ((static_param.a_type == dnnl_f32 || static_param.a_type == dnnl_u8) &&
+                static_param.b_type == (static_param.a_type == dnnl_u8 ? dnnl_s8 : dnnl_f32) &&
                 static_param.c_type == dnnl_f32)
-            _func = make_gemm_stride<16>(static_param.N, static_param.K, static_param.lda, static_param.ldb,
-                static_param.ldc, static_param.post_static_params);
+            _func = make_gemm_stride<16>(static_param, static_param.b_sparse.b ? _b_packed.data() : nullptr);
         return _func != nullptr;
     }
     ~gemm_kernel_impl() {
@@ -454,6 +1004,12 @@ void gemm_kernel<isa>::operator()(const GemmDynMRuntimeParam& runtime_param) {
         static_cast<uint8_t*>(runtime_param.c), &runtime_param.post_runtime_params);
 }
 
+template <cpu_isa_t isa>
+gemm_func_t get_gemm_func(const gemm_kernel<isa>& kernel) {
+    return kernel._impl->_func;
+}
+
 template struct gemm_kernel<cpu_isa_t::avx512_core>;
+template gemm_func_t get_gemm_func(const gemm_kernel<cpu_isa_t::avx512_core>& kernel);
 
 };
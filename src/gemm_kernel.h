@@ -1 +1,18 @@
-#pragma once
\ No newline at end of file
+#pragma once
+
+#include "boat.h"
+
+namespace boat {
+
+// signature of the jit code behind a gemm_kernel
+using gemm_func_t = void (*)(int m, uint8_t* a, uint8_t* b, uint8_t* c, const PostOpRuntimeParams* post_runtime_params);
+
+// jit code of an initialized kernel, lets drivers resolve their kernels once and call them directly
+template <cpu_isa_t isa>
+gemm_func_t get_gemm_func(const gemm_kernel<isa>& kernel);
+
+// prefetch a kernel of this static param compiles in, the defaults of the shape resolved: a_dist and b_dist
+// are the distances, c is 1 or 0; anything off is 0
+GemmPrefetchParam get_prefetch(const GemmDynMStaticParam& static_param);
+
+};
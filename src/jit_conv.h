@@ -0,0 +1,233 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+
+#include <coat/Function.h>
+#include <coat/ControlFlow.h>
+#include <coat/Vec.h>
+#include "dnnl_thread.hpp"
+#include "boat.h"
+#include "jit_math.h"
+#include "jit_postops.h"
+#include "jit_gemm.h"
+
+namespace boat {
+
+//
+// one output row of one image, N: output channels of one block, the kernels of conv and dw_conv only
+// differ in the inner body which adds one (kh, kw) of the window
+//
+// loop order
+// for ow in left border           --> ur = 1, only the kw inside the image
+// for ow_block in middle          --> ur rows with lda = stride_w * src_pixel
+//   for kh in 0..kh_num           --> kh_num excludes the padded rows, computed by the caller
+//     for kw in 0..KW
+//       body                      --> fma into the register block
+// for ow in right border          --> ur = 1, only the kw inside the image
+//
+using conv_func_t = void (*)(int kh_num, uint8_t* src, uint8_t* wei, uint8_t* dst, const PostOpRuntimeParams* post_runtime_params);
+
+// geometry of a row kernel, all strides in floats
+struct conv_row_shape {
+    int IW, OW, KW;
+    int stride_w, pad_l;
+    int src_pixel;      // two input pixels
+    int dst_pixel;      // two output pixels
+    int ld_src_row;     // two input rows
+    int ld_wei_kh;      // two kh of weights
+    int ld_wei_kw;      // two kw of weights
+};
+
+// body(block, ur_num, j_a, j_b, lda, a_offset, b_offset) adds the window at one (kh, kw) to the ur_num
+// pixels of the block: pixel m reads j_a[a_offset + m * lda], the weights start at j_b[b_offset]
+template <unsigned width, typename Body>
+static conv_func_t make_conv_row(const char* name, const conv_row_shape& shape, const PostOpStaticParams& post_static_params,
+    int N, const int (&ur_table)[4], Body body) {
+    int IW = shape.IW, OW = shape.OW, KW = shape.KW;
+    int stride_w = shape.stride_w, pad_l = shape.pad_l;
+    int ldc = shape.dst_pixel;
+    auto fn = coat::createFunction<conv_func_t>(name);
+    if constexpr (width == 16)
+        fn.funcNode->frame().setAvx512Enabled();
+    else if  constexpr (width == 8)
+        fn.funcNode->frame().setAvxEnabled();
+    int oc_num = static_cast<unsigned>((N + width - 1) / width);
+    if (oc_num <= 0 || oc_num > 4) {
+        std::cout << "oc_num must be in [1, 64]" << std::endl;
+        return nullptr;
+    }
+    for (auto i = 0; i < post_static_params.num; i++) {
+        if (post_static_params.ops[i].alg_type >= AlgType::Add &&
+            post_static_params.ops[i].binary_param.layout == BinaryDataLayout::PerElement) {
+            std::cout << name << " does not support PerElement post ops" << std::endl;
+            return nullptr;
+        }
+    }
+    int ur_num = ur_table[oc_num - 1];
+    // [ow_begin, ow_end) sees every kw inside the image
+    int ow_begin = std::min((pad_l + stride_w - 1) / stride_w, OW);
+    int ow_end = IW - KW + pad_l >= 0 ? std::min((IW - KW + pad_l) / stride_w + 1, OW) : 0;
+    ow_end = std::max(ow_end, ow_begin);
+    {
+        bool has_n_tail = (N % width) != 0;
+        if (has_n_tail) {
+            coat::Value<int> j_mask((1 << (N % width)) - 1);
+            _CC.kmovq(asmjit::x86::k1, j_mask);
+        }
+        auto [j_kh_num, j_src_, j_wei_, j_dst_, j_post_runtime_params] = fn.getArguments("kh_num", "src", "wei", "dst", "ops");
+        auto j_src = j_src_.template cast<float>();
+        auto j_wei = j_wei_.template cast<float>();
+        auto j_dst = j_dst_.template cast<float>();
+        jit_gemm_block<width> block(ur_num, oc_num, has_n_tail);
+
+        // postops
+        PostOpBinaryAddrs<width> post_ops(post_static_params, j_post_runtime_params, ldc * sizeof(float));
+        // ur_num output pixels starting at j_a, kws: kw and offset of its first input pixel from j_a
+        auto compute = [&] (int ur_num, coat::wrapper_type<float*>& j_a, std::vector<std::pair<int, int>> kws,
+            coat::wrapper_type<float*>& j_c) {
+            block.zero(ur_num);
+            int lda = stride_w * shape.src_pixel;
+            coat::Value<int> j_kh(int(0), "kh");
+            auto j_a_kh = j_a;
+            auto j_b_kh = j_wei;
+            coat::for_loop(j_kh < j_kh_num,
+                [&] {
+                    j_kh += 1;
+                    j_a_kh += shape.ld_src_row;
+                    j_b_kh += shape.ld_wei_kh;
+                },
+                [&] {
+                    for (auto& kw_offset : kws)
+                        body(block, ur_num, j_a_kh, j_b_kh, lda, kw_offset.second, kw_offset.first * shape.ld_wei_kw);
+                });
+            post_ops.apply(ur_num, oc_num, has_n_tail, block.result);
+            block.store(ur_num, j_c, ldc, [] (auto& vec, auto&& mem) {
+                vec.store(std::move(mem));
+            });
+        };
+        // border pixel: only the kw inside the image, offsets from the start of the row
+        auto compute_border = [&] (int ow) {
+            std::vector<std::pair<int, int>> kws;
+            for (int kw = 0; kw < KW; kw++) {
+                int iw = ow * stride_w - pad_l + kw;
+                if (iw >= 0 && iw < IW)
+                    kws.push_back({kw, iw * shape.src_pixel});
+            }
+            auto j_c = j_dst;
+            j_c += ow * ldc;
+            compute(1, j_src, kws, j_c);
+        };
+        for (int ow = 0; ow < ow_begin; ow++)
+            compute_border(ow);
+        if (ow_end > ow_begin) {
+            std::vector<std::pair<int, int>> kws;
+            for (int kw = 0; kw < KW; kw++)
+                kws.push_back({kw, kw * shape.src_pixel});
+            // j_a points to the first input pixel of the ur block
+            auto j_a = j_src;
+            j_a += (ow_begin * stride_w - pad_l) * shape.src_pixel;
+            auto j_c = j_dst;
+            j_c += ow_begin * ldc;
+            int ow_blocks = (ow_end - ow_begin) / ur_num;
+            coat::Value<int> j_ow(int(0), "ow");
+            coat::for_loop(j_ow < ow_blocks,
+                [&] {
+                    j_ow += 1;
+                    j_a += ur_num * stride_w * shape.src_pixel;
+                    j_c += ur_num * ldc;
+                },
+                [&] {
+                    compute(ur_num, j_a, kws, j_c);
+                });
+            if ((ow_end - ow_begin) % ur_num)
+                compute((ow_end - ow_begin) % ur_num, j_a, kws, j_c);
+        }
+        for (int ow = ow_end; ow < OW; ow++)
+            compute_border(ow);
+        // specify return value
+        coat::ret();
+    }
+
+    // finalize code generation and get function pointer to the generated function
+    auto foo = fn.finalize();
+    return foo;
+}
+
+// the row kernels of one conv and the loop over (image, output row, N block) that calls them
+struct conv_rows {
+    // geometry of the whole conv, strides in floats
+    struct shape_t {
+        int IH, OH, KH;
+        int stride_h, pad_t;
+        size_t ld_src_row;      // two input rows
+        size_t ld_wei_kh;       // two kh of weights
+        size_t ld_dst_row;      // two output rows
+        bool src_per_channel;   // src moves with the N block, depthwise
+    };
+    std::unordered_map<int, conv_func_t> _kernels;
+    int _N_block_num = 0;
+    int _N_block = 0;
+    int _N_block_tail = 0;
+    shape_t _shape;
+    PostOpStaticParams _post_static_params;
+
+    // make(N) builds the kernel of a block of N channels
+    template <typename Make>
+    bool init(const shape_t& shape, const PostOpStaticParams& post_static_params, int OC, int N_block, Make make) {
+        _shape = shape;
+        _post_static_params = post_static_params;
+        _N_block = N_block;
+        _N_block_num = (OC + _N_block - 1) / _N_block;
+        _N_block_tail = OC % _N_block;
+        _kernels[_N_block] = make(_N_block);
+        if (!_kernels[_N_block])
+            return false;
+        if (_N_block_tail) {
+            _kernels[_N_block_tail] = make(_N_block_tail);
+            if (!_kernels[_N_block_tail])
+                return false;
+        }
+        return true;
+    }
+
+    void exec(int mb, void* src_base, void* wei_base, void* dst_base, const PostOpRuntimeParams& post_runtime_params) {
+        auto& p = _shape;
+        dnnl::impl::parallel_nd(mb * p.OH * _N_block_num, [&](dim_t i) {
+            int ocb = static_cast<int>(i % _N_block_num);
+            int oh = static_cast<int>(i / _N_block_num % p.OH);
+            int n = static_cast<int>(i / _N_block_num / p.OH);
+            // rows of the window inside the image
+            int ih = oh * p.stride_h - p.pad_t;
+            int kh_start = std::max(0, -ih);
+            int kh_end = std::min(p.KH, p.IH - ih);
+            int kh_num = std::max(0, kh_end - kh_start);
+            size_t oc = static_cast<size_t>(ocb) * _N_block;
+            auto src = static_cast<uint8_t*>(src_base) +
+                ((static_cast<size_t>(n) * p.IH + ih + kh_start) * p.ld_src_row + (p.src_per_channel ? oc : 0)) * sizeof(float);
+            auto wei = static_cast<uint8_t*>(wei_base) + (kh_start * p.ld_wei_kh + oc) * sizeof(float);
+            auto dst = static_cast<uint8_t*>(dst_base) + ((static_cast<size_t>(n) * p.OH + oh) * p.ld_dst_row + oc) * sizeof(float);
+            PostOpRuntimeParams ops = post_runtime_params;
+            for (int j = 0; j < _post_static_params.num; j++) {
+                if (_post_static_params.ops[j].alg_type >= AlgType::Add &&
+                    _post_static_params.ops[j].binary_param.layout == BinaryDataLayout::PerChannel)
+                    ops.params[j].right_addr = post_runtime_params.params[j].right_addr + oc;
+            }
+            if (ocb == _N_block_num - 1 && _N_block_tail)
+                _kernels[_N_block_tail](kh_num, src, wei, dst, &ops);
+            else
+                _kernels[_N_block](kh_num, src, wei, dst, &ops);
+        });
+    }
+
+    ~conv_rows() {
+        for (auto& kernel : _kernels) {
+            if (kernel.second)
+                coat::getJitRuntimeEnv().release_func(kernel.second);
+        }
+    }
+};
+
+};
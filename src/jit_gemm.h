@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <coat/Function.h>
+#include <coat/Vec.h>
+#include "boat.h"
+#include "jit_math.h"
+
+namespace boat {
+
+// columns of one kernel of matmul and conv: N_block when given, else all of N up to 64, else 64 when it
+// splits N rounded to 16 and 48 does not, else 48
+inline int get_N_block(int N, int N_block = 0) {
+    if (N_block)
+        return std::min(N_block, N);
+    if (N <= 64) return N;
+
+    N = (N + 15) / 16 * 16;
+    if (N % 64 == 0 && N % 48 != 0)
+        return 64;
+
+    return 48;
+}
+
+// register block of the gemm like kernels: ur_num rows of oc_num result vecs, oc_num vecs of B and a
+// broadcast A; the last vec of a row covers the N tail through k1 when has_n_tail
+template <unsigned width>
+struct jit_gemm_block {
+    int oc_num;
+    bool has_n_tail;
+    std::vector<share_vec<width>> weight;
+    std::vector<share_vec<width>> result;
+    coat::Vec<float, width> data;
+
+    jit_gemm_block(int ur_num, int oc_num, bool has_n_tail) : oc_num(oc_num), has_n_tail(has_n_tail) {
+        for (int i = 0; i < oc_num; i++)
+            weight.push_back(std::make_shared<coat::Vec<float, width>>());
+        for (int i = 0; i < oc_num * ur_num; i++)
+            result.push_back(std::make_shared<coat::Vec<float, width>>());
+    }
+
+    void zero(int ur_num) {
+        for (int i = 0; i < oc_num * ur_num; i++)
+            *result[i] = 0;
+    }
+
+    // result[m][n] += a[a_offset + m * lda + j] * b[b_offset + j * ldb + n * width] for j < k_num,
+    // load_b(vec, mem) loads the full vecs of B; vnni: u8 quads of A times s8 quads of B into s32
+    template <typename LoadB>
+    void fma(int ur_num, int k_num, coat::wrapper_type<float*>& j_a, coat::wrapper_type<float*>& j_b,
+        int lda, int ldb, LoadB load_b, bool vnni = false, int a_offset = 0, int b_offset = 0) {
+        for (int j = 0; j < k_num; j++) {
+            for (int n = 0; n < oc_num - has_n_tail; n++) {
+                load_b(*weight[n], j_b[b_offset + j * ldb + n * width]);
+            }
+            if (has_n_tail) {
+                weight[oc_num - 1]->kzload(j_b[b_offset + j * ldb + (oc_num - 1) * width], asmjit::x86::k1);
+            }
+            for (int m = 0; m < ur_num; m++) {
+                data.load(j_a[a_offset + m * lda + j], true);
+                for (int n = 0; n < oc_num; n++) {
+                    if (vnni)
+                        _CC.vpdpbusd(result[m * oc_num + n]->reg, data.reg, weight[n]->reg);
+                    else
+                        result[m * oc_num + n]->fma231(*weight[n], data);
+                }
+            }
+        }
+    }
+
+    // c[m * ldc + n * width] = result[m][n], store_c(vec, mem) writes the full vecs
+    template <typename StoreC>
+    void store(int ur_num, coat::wrapper_type<float*>& j_c, int ldc, StoreC store_c) {
+        for (int m = 0; m < ur_num; m++) {
+            for (int n = 0; n < oc_num - has_n_tail; n++) {
+                store_c(*result[m * oc_num + n], j_c[m * ldc + n * width]);
+            }
+            if (has_n_tail) {
+                result[m * oc_num + oc_num - 1]->kstore(j_c[m * ldc + (oc_num - 1) * width], asmjit::x86::k1);
+            }
+        }
+    }
+};
+
+};
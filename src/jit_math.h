@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <coat/Function.h>
+#include <coat/Vec.h>
+
+namespace boat {
+template<unsigned width>
+using share_vec = std::shared_ptr<coat::Vec<float, width>>;
+
+// math helpers shared by the jit kernels, all of them work in place on coat::Vec
+
+// horizontal max/sum of v, the result is broadcast to all lanes
+template <unsigned width>
+void jit_reduce(coat::Vec<float, width>& v, bool is_max) {
+    coat::Vec<float, width> tmp;
+    auto op = [&] {
+        if (is_max)
+            v.max_(tmp);
+        else
+            v.add(tmp);
+    };
+    if constexpr (width == 16) {
+        // swap 256-bit halves, then neighbouring 128-bit lanes
+        _CC.vshuff32x4(tmp.reg, v.reg, v.reg, 0x4E);
+        op();
+        _CC.vshuff32x4(tmp.reg, v.reg, v.reg, 0xB1);
+        op();
+    } else if constexpr (width == 8) {
+        _CC.vperm2f128(tmp.reg, v.reg, v.reg, 0x01);
+        op();
+    }
+    _CC.vpermilps(tmp.reg, v.reg, 0x4E);
+    op();
+    _CC.vpermilps(tmp.reg, v.reg, 0xB1);
+    op();
+}
+
+// v = exp(v): v = n * ln2 + r, r in [-ln2/2, ln2/2], exp(v) = 2^n * p(r)
+template <unsigned width>
+void jit_exp(coat::Vec<float, width>& v) {
+    // p(r) = 1 + r * (p1 + r * (p2 + r * (p3 + r * (p4 + r * p5)))), coefficients from oneDNN
+    static const float pol[] = { 0.00828929059f, 0.0418978221f, 0.166676521f, 0.499991506f, 0.999999701f, 1.0f };
+    coat::Vec<float, width> n, p, c;
+    c = 88.3762626647949f;
+    v.min_(c);
+    c = -87.3365447504f;
+    v.max_(c);
+    n = 1.44269504089f;
+    n.mul(v);
+    if constexpr (width == 16)
+        _CC.vrndscaleps(n.reg, n.reg, 0);
+    else
+        _CC.vroundps(n.reg, n.reg, 0);
+    // ln2 is split in two parts to keep r accurate
+    c = 0.693359375f;
+    _CC.vfnmadd231ps(v.reg, n.reg, c.reg);
+    c = -2.12194440e-4f;
+    _CC.vfnmadd231ps(v.reg, n.reg, c.reg);
+    p = pol[0];
+    for (int i = 1; i < static_cast<int>(sizeof(pol) / sizeof(pol[0])); i++) {
+        c = pol[i];
+        _CC.vfmadd213ps(p.reg, v.reg, c.reg);
+    }
+    if constexpr (width == 16) {
+        _CC.vscalefps(v.reg, p.reg, n.reg);
+    } else {
+        // add n to the exponent field
+        _CC.vcvtps2dq(n.reg, n.reg);
+        _CC.vpslld(n.reg, n.reg, 23);
+        _CC.vpaddd(v.reg, p.reg, n.reg);
+    }
+}
+
+// v = log(v) for v > 0: v = 2^e * m, m in [1, 2), log(m) = 2 * atanh((m - 1) / (m + 1))
+template <unsigned width>
+void jit_log(coat::Vec<float, width>& v) {
+    static_assert(width == 16, "log needs avx512 vgetexpps/vgetmantps");
+    // 2 * (1 + t^2 / 3 + t^4 / 5 + ...)
+    static const float pol[] = { 2.0f / 11, 2.0f / 9, 2.0f / 7, 2.0f / 5, 2.0f / 3, 2.0f };
+    coat::Vec<float, width> e, t, t2, p, c;
+    _CC.vgetexpps(e.reg, v.reg);
+    _CC.vgetmantps(v.reg, v.reg, 0);
+    c = 1.0f;
+    t = v;
+    t.sub(c);
+    v.add(c);
+    t.div(v);
+    t2 = t;
+    t2.mul(t);
+    p = pol[0];
+    for (int i = 1; i < static_cast<int>(sizeof(pol) / sizeof(pol[0])); i++) {
+        c = pol[i];
+        _CC.vfmadd213ps(p.reg, t2.reg, c.reg);
+    }
+    v = p;
+    v.mul(t);
+    c = 0.693147180560f;
+    v.fma231(e, c);
+}
+
+// column index of every lane, used to pick single columns with vpcmpeqd
+static const int lane_index[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63 };
+
+};
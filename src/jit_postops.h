@@ -0,0 +1,144 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <coat/Function.h>
+#include <coat/Vec.h>
+#include "boat.h"
+#include "jit_math.h"
+
+namespace boat {
+////////////////////////////////////////////////////
+// generate jit kernel needed param when injecting kernels, private
+struct PostOpInjectParam {
+    BinaryDataLayout layout;
+    coat::Ptr<coat::Value<float>> right_addrs_base;
+    std::vector<int> right_addrs_offset;
+    // PerElement: offset of the first row in floats, the vecs need masked load for N tail
+    std::shared_ptr<coat::Value<int64_t>> right_addrs_row;
+    std::vector<bool> right_addrs_masked;
+};
+
+struct PostOpInjectParams {
+    PostOpInjectParam params[MAX_POSTOPS_NUM];
+};
+
+template <unsigned width>
+void inject_postops(int vecs_num, std::vector<share_vec<width>> vecs, PostOpStaticParams& ops_param, PostOpInjectParams& inject_ops_param) {
+    for (auto i = 0; i < ops_param.num; i++) {
+        switch (ops_param.ops[i].alg_type) {
+            case AlgType::Abs: {
+                coat::Vec<float, width> tmp;
+                std::for_each(vecs.begin(), vecs.begin() + vecs_num, [&] (share_vec<width> vec) {
+                    tmp = -0.f;
+                    tmp -= *vec;
+                    vec->max_(tmp);
+                });
+                break;
+            }
+            case AlgType::Add: {
+                if (inject_ops_param.params[i].layout == BinaryDataLayout::PerTensor) {
+                    coat::Vec<float, width> tmp;
+                    tmp.load(inject_ops_param.params[i].right_addrs_base[0], true);
+                    std::for_each(vecs.begin(), vecs.begin() + vecs_num, [&] (share_vec<width> vec) {
+                        *vec += tmp;
+                    });
+                } else if (inject_ops_param.params[i].layout == BinaryDataLayout::PerChannel) {
+                    auto& base = inject_ops_param.params[i].right_addrs_base;
+                    for (int j = 0; j < vecs_num; j++) {
+                        auto idx = inject_ops_param.params[i].right_addrs_offset[j];
+                        *vecs[j] += base[idx];
+                    }
+                } else {
+                    auto& param = inject_ops_param.params[i];
+                    coat::Vec<float, width> tmp;
+                    for (int j = 0; j < vecs_num; j++) {
+                        auto offset = param.right_addrs_offset[j] * static_cast<int>(sizeof(float));
+                        if (param.right_addrs_masked[j]) {
+                            tmp.kzload(param.right_addrs_base.index(*param.right_addrs_row, sizeof(float), offset), asmjit::x86::k1);
+                            *vecs[j] += tmp;
+                        } else {
+                            *vecs[j] += param.right_addrs_base.index(*param.right_addrs_row, sizeof(float), offset);
+                        }
+                    }
+                }
+                break;
+            }
+            default:
+                // TODO: add other post ops
+                _CC.int3();
+                break;
+        }
+    }
+}
+
+// second inputs of the binary post ops of one kernel: right_addr of every binary op is read once from the
+// ops argument, apply points them at a block of ur_num x oc_num vecs and injects the post ops
+template <unsigned width>
+struct PostOpBinaryAddrs {
+    using share_p = std::shared_ptr<coat::Ptr<coat::Value<float>>>;
+    PostOpStaticParams post_static_params;
+    PostOpInjectParams inject_postops_param;
+    std::vector<share_p> post_ops_runtime_addrs;
+    int ldc;        // bytes between two rows of C, the PerElement default
+
+    PostOpBinaryAddrs(const PostOpStaticParams& post_static_params, coat::wrapper_type<const PostOpRuntimeParams*>& j_post_runtime_params,
+        int ldc) : post_static_params(post_static_params), ldc(ldc) {
+        // extract all second address from parameter 'ops' of jit func
+        for (auto i = 0; i < post_static_params.num; i++) {
+            if (post_static_params.ops[i].alg_type >= AlgType::Add) {
+                auto params = j_post_runtime_params.template get_value<PostOpRuntimeParams::member_params>("params");
+                auto addr = params[i].template get_value<PostOpRuntimeParam::member_right_addr>("addr");
+                // TODO: ptr has no 'operator= addr'
+                auto op = std::make_shared<typename share_p::element_type>(addr);
+                post_ops_runtime_addrs.push_back(op);
+            } else {
+                auto op = std::make_shared<typename share_p::element_type>();
+                // no need, just a placeholder
+                post_ops_runtime_addrs.push_back(op);
+            }
+        }
+    }
+
+    // vec m * oc_num + n reads column n * width, PerElement also row j_row + m * row_stride
+    void prepare(int ur_num, int oc_num, bool has_n_tail, coat::Value<int64_t>* j_row, int row_stride) {
+        for (auto i = 0; i < post_static_params.num; i++) {
+            auto& binary_param = post_static_params.ops[i].binary_param;
+            if (post_static_params.ops[i].alg_type >= AlgType::Add && binary_param.layout != BinaryDataLayout::PerTensor) {
+                auto& ptr = *post_ops_runtime_addrs[i];
+                auto& inject_param = inject_postops_param.params[i];
+                inject_param.right_addrs_offset.clear();
+                inject_param.right_addrs_masked.clear();
+                inject_param.layout = binary_param.layout;
+                inject_param.right_addrs_base.reg = ptr.reg;
+                if (binary_param.layout == BinaryDataLayout::PerChannel) {
+                    for (int j = 0; j < ur_num; j++)
+                        for (int k = 0; k < oc_num; k++)
+                            inject_param.right_addrs_offset.push_back(k * width);
+                } else {
+                    int ld = (binary_param.ld ? binary_param.ld : ldc) / sizeof(float);
+                    inject_param.right_addrs_row = std::make_shared<coat::Value<int64_t>>("right_row");
+                    *inject_param.right_addrs_row = *j_row;
+                    *inject_param.right_addrs_row *= ld;
+                    for (int j = 0; j < ur_num; j++) {
+                        for (int k = 0; k < oc_num; k++) {
+                            inject_param.right_addrs_offset.push_back(j * row_stride * ld + k * width);
+                            inject_param.right_addrs_masked.push_back(has_n_tail && k == oc_num - 1);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // j_row is only read by PerElement ops
+    void apply(int ur_num, int oc_num, bool has_n_tail, std::vector<share_vec<width>>& vecs,
+        coat::Value<int64_t>* j_row = nullptr, int row_stride = 1) {
+        prepare(ur_num, oc_num, has_n_tail, j_row, row_stride);
+        inject_postops<width>(ur_num * oc_num, vecs, post_static_params, inject_postops_param);
+    }
+};
+
+};
@@ -5,59 +5,633 @@
 #include <memory>
 #include <chrono>
 #include <iostream>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <atomic>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 
 #include "dnnl_thread.hpp"
+#if DNNL_CPU_THREADING_RUNTIME == DNNL_RUNTIME_TBB
+#include "tbb/info.h"
+#include "tbb/task_group.h"
+#endif
 #include "tool.h"
 #include "boat.h"
+#include "gemm_kernel.h"
+#include "jit_gemm.h"
+#include "matmul.h"
+#include "scratch_pool.h"
 
 using namespace dnnl::impl;
 using namespace dnnl::impl::utils;
 
 namespace boat {
 
+// autotuned blocking per "<cpu brand> threads N K lda ldb ldc", loaded once from BOAT_TUNE_CACHE
+static std::mutex tune_mutex;
+static std::unordered_map<std::string, GemmBlockingParam> tune_cache;
+static bool tune_cache_loaded = false;
+// time to wake a parallel region per thread number, measured once
+static std::mutex wake_mutex;
+static std::unordered_map<int, double> wake_cache;
+
+// parallel and parallel_nd through a functor holding a pointer to f: std::function keeps it inline,
+// so starting a region does not allocate
+template <typename F>
+static void parallel_ref(int nthr, const F& f) {
+    auto ref = &f;
+    parallel(nthr, [ref](const int ithr, const int nthr) { (*ref)(ithr, nthr); });
+}
+
+template <typename F>
+static void parallel_rows(dim_t rows, const F& f) {
+    auto ref = &f;
+    parallel(adjust_num_threads(0, rows), [ref, rows](const int ithr, const int nthr) {
+        dim_t start, end;
+        balance211(rows, nthr, ithr, start, end);
+        for (dim_t m = start; m < end; m++)
+            (*ref)(m);
+    });
+}
+
+static std::string get_tune_key(const GemmDynMStaticParam& param) {
+    static const std::string brand = [] {
+        auto brand = getCpuBrand();
+        std::replace(brand.begin(), brand.end(), ' ', '_');
+        return brand;
+    }();
+    std::ostringstream key;
+    key << brand << "|" << dnnl_get_max_threads() << "|" << param.N << "|" << param.K << "|"
+        << param.lda << "|" << param.ldb << "|" << param.ldc;
+    return key.str();
+}
+
+static void load_tune_cache() {
+    auto path = std::getenv("BOAT_TUNE_CACHE");
+    if (!path)
+        return;
+    std::ifstream file(path);
+    std::string key;
+    GemmBlockingParam blocking;
+    while (file >> key >> blocking.ur_num >> blocking.m_group >> blocking.N_block)
+        tune_cache[key] = blocking;
+}
+
+static void save_tune_entry(const std::string& key, const GemmBlockingParam& blocking) {
+    auto path = std::getenv("BOAT_TUNE_CACHE");
+    if (!path)
+        return;
+    std::ofstream file(path, std::ios::app);
+    file << key << " " << blocking.ur_num << " " << blocking.m_group << " " << blocking.N_block << "\n";
+}
+
 struct matmul::matmul_impl {
     std::unordered_map<int, gemm_kernel<cpu_isa_t::avx512_core>> _kernels;
+    // jit code of the N block and the N tail kernel, resolved at init so exec only calls through pointers
+    struct kernel_funcs {
+        gemm_func_t block = nullptr;
+        gemm_func_t tail = nullptr;
+    };
+    kernel_funcs _funcs;
+    // kernels compiled for one m, used when the M block or the M tail of a call has that m
+    struct fixed_m_kernels {
+        gemm_kernel<cpu_isa_t::avx512_core> block, tail;
+        kernel_funcs funcs;
+    };
+    std::unordered_map<int, fixed_m_kernels> _fixed_kernels;
+    // everything exec derives from m and the thread number, built on the first call with that m
+    struct exec_plan {
+        int m = 0;
+        int nthread_in = 0;
+        int nthread = 0;            // picked by the cost model
+        int M = 0;                  // rows of an M block
+        int M_tail = 0;
+        int M_block = 0;            // number of M blocks
+        int work_amount = 0;
+        bool loopN = false;
+        kernel_funcs fixed_block;   // block is nullptr without fixed m kernels
+        kernel_funcs fixed_tail;
+    };
+    // lock free open addressing on m: an empty slot is taken with compare exchange, entries live until
+    // the matmul is destroyed or initialized again
+    static constexpr int plan_slots = 256;
+    static constexpr int plan_probes = 8;
+    std::array<std::atomic<exec_plan*>, plan_slots> _plans {};
+    // C larger than L3: kernels with non-temporal C stores
+    std::unordered_map<int, gemm_kernel<cpu_isa_t::avx512_core>> _stream_kernels;
+    kernel_funcs _stream_funcs;
+    // B, C and their strides on cache lines: kernels with aligned B loads and C stores
+    std::unordered_map<int, gemm_kernel<cpu_isa_t::avx512_core>> _aligned_kernels;
+    kernel_funcs _aligned_funcs;
+    GemmDynMStaticParam _kernel_param;
+    unsigned int _L3;
+    // block sparse B: every N block has its own zero blocks, so its own kernel
+    std::vector<gemm_kernel<cpu_isa_t::avx512_core>> _sparse_kernels;
+    std::vector<gemm_func_t> _sparse_funcs;
     int _nthread = 0;
+    // median time to start and join a parallel region of _nthread threads that went idle
+    double _wake_ns = 0;
+    // blocks are handed out from a shared counter instead of balance211 ranges
+    bool _dynamic = false;
     int _N_block_num = 0;
     int _N_block = 0;
     int _N_block_tail = 0;
     unsigned int _L2;
     GemmDynMStaticParam _dynMStaticParam;
+    // row reduction: kernels write one partial result per N block into reduce_val/reduce_idx of the scratch
+    // unless a single kernel sees the whole row
+    RowReduceStaticParam _row_reduce;
+    bool _reduce_row = false;
+    bool _reduce_direct = false;
+    int _reduce_slots = 0;
+    // row normalization of rows wider than one N block: kernels keep the raw rows in C and
+    // reduce their log-sum-exp (softmax), moments (layer norm) or sum of squares (rms norm) into row_stat,
+    // exec normalizes C afterwards
+    bool _norm_two_pass = false;
+    // dynamic quantization: B packed as [K4 / 4][N16][4] with its scales and compensation padded to N16,
+    // each thread quantizes the M block it works on into its own buffer
+    bool _quant = false;
+    int _K4 = 0;
+    quantize _quantize;
+    std::vector<int8_t> _b_quant;
+    std::vector<float> _b_scale;
+    std::vector<int> _b_comp;
+    // buffers of one call, see scratch_pool; they only grow, so calls of an M seen before or sized at init
+    // from hot_m do not allocate
+    struct exec_scratch {
+        std::vector<float> reduce_val;
+        std::vector<int> reduce_idx;
+        std::vector<float> row_stat;
+        std::vector<std::vector<uint8_t>> a_quant;
+        std::vector<std::vector<float>> a_scale;
+    };
+    scratch_pool<exec_scratch> _scratch;
+#if DNNL_CPU_THREADING_RUNTIME == DNNL_RUNTIME_TBB
+    // B replicas: one arena per NUMA node, the copy of a node is first touched by the threads of that node
+    // and keeps the cache line offset of the original so the kernel dispatch does not change
+    struct numa_node {
+        std::unique_ptr<tbb::task_arena> arena;
+        std::unique_ptr<uint8_t[]> buf;
+        uint8_t* b = nullptr;
+        int thread_offset = 0;
+    };
+    std::vector<numa_node> _numa_nodes;
+    static constexpr size_t max_numa_nodes = 8;
+#endif
+    const void* _numa_b = nullptr;
+    int _numa_threads = 0;
 
     matmul_impl() {
         _L2 = getDataCacheSize(2);
+        _L3 = getDataCacheSize(3);
     }
 
-    int get_N_block(const GemmDynMStaticParam& static_param) {
-        if (static_param.N <= 64) return static_param.N;
-
-        auto N = (static_param.N + 15) / 16 * 16;
-        if (N % 64 == 0 && N % 48 != 0)
-            return 64;
-
-        return 48;
+    // times every candidate on tune_m and returns the fastest, the score is the time per row summed over tune_m
+    static GemmBlockingParam tune(const GemmDynMStaticParam& static_param) {
+        std::vector<int> ms;
+        for (auto m : static_param.blocking.tune_m) {
+            if (m > 0)
+                ms.push_back(m);
+        }
+        if (ms.empty())
+            ms = {32, 256, 2048};
+        int max_m = *std::max_element(ms.begin(), ms.end());
+        int N = static_param.N, K = static_param.K;
+        std::vector<float> a(static_cast<size_t>(max_m) * static_param.lda / sizeof(float)),
+            b(static_cast<size_t>(K) * static_param.ldb / sizeof(float)),
+            c(static_cast<size_t>(max_m) * static_param.ldc / sizeof(float));
+        for (size_t i = 0; i < a.size(); i++) a[i] = static_cast<float>(i % 7) / 8.0f;
+        for (size_t i = 0; i < b.size(); i++) b[i] = static_cast<float>(i % 5) / 8.0f;
+        // only the register blocking differs between the candidates
+        GemmDynMStaticParam param = {
+            dnnl_f32, dnnl_f32, dnnl_f32,
+            N, K, static_param.lda, static_param.ldb, static_param.ldc
+        };
+        std::vector<int> N_blocks;
+        for (int n = 16; n <= 64 && n < N; n += 16)
+            N_blocks.push_back(n);
+        if (N <= 64)
+            N_blocks.push_back(N);
+        GemmBlockingParam best;
+        double best_score = std::numeric_limits<double>::max();
+        for (auto N_block : N_blocks) {
+            int oc_num = (N_block + 15) / 16;
+            int max_ur = 31 / oc_num - 1;
+            std::vector<int> urs;
+            for (int ur : {4, 6, 8, max_ur}) {
+                if (ur <= max_ur && std::find(urs.begin(), urs.end(), ur) == urs.end())
+                    urs.push_back(ur);
+            }
+            for (auto ur : urs) {
+                for (int m_group : {1, 4, 16}) {
+                    param.blocking.ur_num = ur;
+                    param.blocking.m_group = m_group;
+                    param.blocking.N_block = N_block;
+                    matmul gemm;
+                    if (!gemm.init(param))
+                        continue;
+                    double score = 0;
+                    for (auto m : ms) {
+                        GemmDynMRuntimeParam runtime_param = {
+                            m, a.data(), b.data(), c.data()
+                        };
+                        // warm up, then the best of 3
+                        gemm(runtime_param);
+                        double best_time = std::numeric_limits<double>::max();
+                        for (int i = 0; i < 3; i++) {
+                            auto start = std::chrono::steady_clock::now();
+                            gemm(runtime_param);
+                            auto end = std::chrono::steady_clock::now();
+                            best_time = std::min(best_time, std::chrono::duration<double>(end - start).count());
+                        }
+                        score += best_time / m;
+                    }
+                    if (score < best_score) {
+                        best_score = score;
+                        best = param.blocking;
+                    }
+                }
+            }
+        }
+        return best;
     }
 
     bool init(const GemmDynMStaticParam& static_param) {
-        _nthread = dnnl_get_max_threads();
+        auto& blocking = static_param.blocking;
+        if (blocking.autotune) {
+            GemmDynMStaticParam param = static_param;
+            param.blocking.autotune = false;
+            bool dense_f32 = static_param.a_type == dnnl_f32 && static_param.b_type == dnnl_f32 &&
+                !static_param.b_sparse.block_mask && !static_param.b_sparse.b;
+            if (dense_f32) {
+                std::lock_guard<std::mutex> lock(tune_mutex);
+                if (!tune_cache_loaded) {
+                    load_tune_cache();
+                    tune_cache_loaded = true;
+                }
+                auto key = get_tune_key(static_param);
+                auto it = tune_cache.find(key);
+                if (it == tune_cache.end()) {
+                    it = tune_cache.emplace(key, tune(static_param)).first;
+                    save_tune_entry(key, it->second);
+                }
+                param.blocking.ur_num = it->second.ur_num;
+                param.blocking.m_group = it->second.m_group;
+                param.blocking.N_block = it->second.N_block;
+            }
+            return init(param);
+        }
+        if (blocking.N_block && blocking.N_block < static_param.N && (blocking.N_block % 16 || blocking.N_block > 64))
+            return false;
+        if (static_param.schedule.chunk < 0)
+            return false;
+        _dynamic = static_param.schedule.kind == GemmSchedule::Dynamic ||
+            (static_param.schedule.kind == GemmSchedule::Auto && isHybridCpu());
+        reset();
+        _nthread = static_param.context ? static_param.context->nthread() : dnnl_get_max_threads();
+        if (!static_param.schedule.all_threads) {
+            if (static_param.context)
+                static_param.context->execute([&] { measure_wake(); });
+            else
+                measure_wake();
+        }
         auto N = static_param.N;
-        _N_block = get_N_block(static_param);
+        auto& row_reduce = _row_reduce;
+        _N_block = get_N_block(static_param.N, static_param.blocking.N_block);
+        _N_block_num = (N + _N_block - 1) / _N_block;
+        _row_reduce = static_param.row_reduce;
+        if (static_param.row_norm.alg != RowNormAlg::None) {
+            if (row_reduce.alg != RowReduceAlg::None || static_param.c_store_mode != CStoreMode::Normal)
+                return false;
+            _norm_two_pass = _N_block_num > 1;
+            if (_norm_two_pass) {
+                switch (static_param.row_norm.alg) {
+                    case RowNormAlg::LayerNorm: row_reduce.alg = RowReduceAlg::Moments; break;
+                    case RowNormAlg::RMSNorm: row_reduce.alg = RowReduceAlg::SumSquare; break;
+                    default: row_reduce.alg = RowReduceAlg::LogSumExp; break;
+                }
+            }
+        }
+        _reduce_row = row_reduce.alg != RowReduceAlg::None;
+        _reduce_slots = get_row_reduce_slots(row_reduce);
+        _reduce_direct = _N_block_num == 1 && row_reduce.alg != RowReduceAlg::LogSumExp;
+        if (row_reduce.alg == RowReduceAlg::TopK && row_reduce.k > N)
+            return false;
         GemmDynMStaticParam param = static_param;
+        param.row_reduce = row_reduce;
+        // alignment is checked per call, see use_aligned
+        param.aligned = false;
+        if (_norm_two_pass)
+            param.row_norm.alg = RowNormAlg::None;
+        if (static_param.a_type == dnnl_f32 && static_param.b_type == dnnl_s8 && !init_quant(static_param, param))
+            return false;
+        if (_reduce_row && !_reduce_direct)
+            param.row_reduce.ld = _reduce_slots * _N_block_num;
+        _N_block_tail = N % _N_block;
+        if (static_param.b_sparse.block_mask || static_param.b_sparse.b) {
+            auto& b_sparse = static_param.b_sparse;
+            _sparse_kernels.resize(_N_block_num);
+            for (int ocb = 0; ocb < _N_block_num; ocb++) {
+                param.N = get_block_width(ocb);
+                param.row_reduce.k = std::min(row_reduce.k, param.N);
+                if (b_sparse.block_mask) {
+                    param.b_sparse.ld_mask = b_sparse.ld_mask ? b_sparse.ld_mask : (N + 15) / 16;
+                    param.b_sparse.block_mask = b_sparse.block_mask + ocb * _N_block / 16;
+                }
+                if (b_sparse.b)
+                    param.b_sparse.b = b_sparse.b + ocb * _N_block;
+                if (!_sparse_kernels[ocb].init(param))
+                    return false;
+                _sparse_funcs.push_back(get_gemm_func(_sparse_kernels[ocb]));
+            }
+            _dynMStaticParam = static_param;
+            return true;
+        }
+        _kernel_param = param;
         param.N = _N_block;
         if (!_kernels[_N_block].init(param))
             return false;
         if (N % _N_block) {
-            _N_block_tail = N % _N_block;
             param.N = _N_block_tail;
+            param.row_reduce.k = std::min(row_reduce.k, _N_block_tail);
             if (!_kernels[_N_block_tail].init(param))
                 return false;
         }
-        _N_block_num = (N + _N_block - 1) / _N_block;
+        _funcs = resolve(_kernels);
         _dynMStaticParam = static_param;
+        init_variants();
+        if (!init_fixed_m(param, row_reduce.k) || !init_numa(static_param))
+            return false;
+        init_hot_m();
         return true;
     }
 
-    int get_M_block(int M) {
+    bool init_numa(const GemmDynMStaticParam& static_param) {
+        auto& numa = static_param.numa;
+        if (!numa.replicate_b)
+            return true;
+        if (!_quant && !numa.b) {
+            std::cout << "replicating B needs numa.b or quant" << std::endl;
+            return false;
+        }
+        auto src = _quant ? reinterpret_cast<const uint8_t*>(_b_quant.data()) : reinterpret_cast<const uint8_t*>(numa.b);
+        size_t size = _quant ? _b_quant.size() : static_cast<size_t>(static_param.K - 1) * static_param.ldb + static_param.N * sizeof(float);
+#if DNNL_CPU_THREADING_RUNTIME == DNNL_RUNTIME_TBB
+        std::vector<tbb::numa_node_id> ids;
+        if (numa.nodes)
+            ids.assign(numa.nodes, numa.nodes + numa.node_num);
+        else
+            ids = tbb::info::numa_nodes();
+        if (ids.size() < 2)
+            return true;
+        // exec keeps the per node state on the stack
+        if (ids.size() > max_numa_nodes)
+            ids.resize(max_numa_nodes);
+        size_t offset = reinterpret_cast<uintptr_t>(src) % 64;
+        _numa_nodes.resize(ids.size());
+        for (size_t i = 0; i < ids.size(); i++) {
+            auto& node = _numa_nodes[i];
+            node.arena = std::make_unique<tbb::task_arena>(tbb::task_arena::constraints(ids[i]));
+            node.arena->initialize();
+            // new[] leaves the pages untouched
+            node.buf.reset(new uint8_t[size + 64]);
+            node.b = node.buf.get() + (64 - reinterpret_cast<uintptr_t>(node.buf.get()) % 64) % 64 + offset;
+            node.thread_offset = _numa_threads;
+            node.arena->execute([&] {
+                parallel(0, [&](const int ithr, const int nthr) {
+                    size_t start, end;
+                    balance211(size, nthr, ithr, start, end);
+                    if (start < end)
+                        memcpy(node.b + start, src + start, end - start);
+                });
+            });
+            _numa_threads += node.arena->max_concurrency();
+        }
+        _numa_b = _quant ? static_cast<const void*>(_b_quant.data()) : static_cast<const void*>(numa.b);
+#else
+        (void)src;
+        (void)size;
+#endif
+        return true;
+    }
+
+    // compiles kernels for the block and tail m that exec will use for each hot M
+    bool init_fixed_m(GemmDynMStaticParam& param, int reduce_k) {
+        for (auto hot_m : _dynMStaticParam.hot_m) {
+            if (hot_m <= 0)
+                continue;
+            auto M = get_M_block(hot_m, get_exec_nthread(hot_m, _nthread));
+            for (int m : {M, hot_m % M}) {
+                if (m == 0 || _fixed_kernels.count(m))
+                    continue;
+                auto& kernels = _fixed_kernels[m];
+                param.fixed_m = m;
+                param.N = _N_block;
+                param.row_reduce.k = std::min(reduce_k, _N_block);
+                if (!kernels.block.init(param))
+                    return false;
+                if (_N_block_tail) {
+                    param.N = _N_block_tail;
+                    param.row_reduce.k = std::min(reduce_k, _N_block_tail);
+                    if (!kernels.tail.init(param))
+                        return false;
+                    kernels.funcs.tail = get_gemm_func(kernels.tail);
+                }
+                kernels.funcs.block = get_gemm_func(kernels.block);
+            }
+        }
+        return true;
+    }
+
+    bool init_quant(const GemmDynMStaticParam& static_param, GemmDynMStaticParam& param) {
+        auto& quant = static_param.quant;
+        if (!quant.b || !quant.b_scale)
+            return false;
+        int N = static_param.N, K = static_param.K;
+        int N16 = (N + 15) / 16 * 16;
+        _K4 = (K + 3) / 4 * 4;
+        // K rounded up to quads, then [N, K4] -> [K4 / 4][N16][4]
+        std::vector<int8_t> b(static_cast<size_t>(N) * _K4, 0);
+        _b_comp.assign(N16, 0);
+        _b_scale.assign(N16, 0.0f);
+        for (int n = 0; n < N; n++) {
+            const int8_t* src = quant.b + static_cast<size_t>(n) * static_param.ldb;
+            for (int k = 0; k < K; k++) {
+                b[static_cast<size_t>(n) * _K4 + k] = src[k];
+                _b_comp[n] += 128 * src[k];
+            }
+            _b_scale[n] = quant.b_scale[n];
+        }
+        _b_quant.assign(static_cast<size_t>(_K4) * N16, 0);
+        transpose pack;
+        TransposeStaticParam pack_param = {
+            1, 4, _K4, _K4, N16 * 4
+        };
+        if (!pack.init(pack_param))
+            return false;
+        TransposeRuntimeParam pack_runtime = {
+            N, b.data(), _b_quant.data()
+        };
+        pack(pack_runtime);
+
+        QuantizeStaticParam quantize_param = {
+            K, static_param.lda, _K4
+        };
+        if (!_quantize.init(quantize_param))
+            return false;
+        param.a_type = dnnl_u8;
+        param.lda = _K4;
+        param.ldb = N16 * 4;
+        _quant = true;
+        return true;
+    }
+
+    kernel_funcs resolve(const std::unordered_map<int, gemm_kernel<cpu_isa_t::avx512_core>>& kernels) {
+        kernel_funcs funcs;
+        funcs.block = get_gemm_func(kernels.at(_N_block));
+        if (_N_block_tail)
+            funcs.tail = get_gemm_func(kernels.at(_N_block_tail));
+        return funcs;
+    }
+
+    // the kernels exec switches to per call, compiled when the static params allow them; a variant
+    // that fails to compile is just not used
+    void init_variants() {
+        auto& p = _kernel_param;
+        // streaming pays off when C would push A and B out of L3 and nothing reads C back
+        if (_L3 && !_norm_two_pass && p.c_store_mode == CStoreMode::Normal && !p.row_reduce.skip_c && p.ldc % 64 == 0) {
+            auto param = p;
+            param.c_stream = true;
+            init_variant(_stream_kernels, param, _stream_funcs);
+        }
+        // every N block starts on a cache line of B and C when the block width and the strides allow it
+        if (p.c_store_mode == CStoreMode::Normal && _N_block % 16 == 0 && p.ldb % 64 == 0 && p.ldc % 64 == 0) {
+            auto param = p;
+            param.aligned = true;
+            init_variant(_aligned_kernels, param, _aligned_funcs);
+        }
+    }
+
+    // compiles param for the N block and the N tail, leaves kernels empty on failure
+    void init_variant(std::unordered_map<int, gemm_kernel<cpu_isa_t::avx512_core>>& kernels, GemmDynMStaticParam param,
+            kernel_funcs& funcs) {
+        param.N = _N_block;
+        bool ok = kernels[_N_block].init(param);
+        if (ok && _N_block_tail) {
+            param.N = _N_block_tail;
+            param.row_reduce.k = std::min(param.row_reduce.k, _N_block_tail);
+            ok = kernels[_N_block_tail].init(param);
+        }
+        if (ok)
+            funcs = resolve(kernels);
+        else
+            kernels.clear();
+    }
+
+    bool use_stream_c(const GemmDynMRuntimeParam& runtime_param) {
+        return _stream_funcs.block && static_cast<size_t>(runtime_param.m) * _dynMStaticParam.ldc > _L3 &&
+            reinterpret_cast<uintptr_t>(runtime_param.c) % 64 == 0;
+    }
+
+    bool use_aligned(const GemmDynMRuntimeParam& runtime_param, const void* b) {
+        return _aligned_funcs.block && reinterpret_cast<uintptr_t>(b) % 64 == 0 &&
+            reinterpret_cast<uintptr_t>(runtime_param.c) % 64 == 0;
+    }
+
+    // grows the buffers of scratch to what a call with plan needs
+    void reserve_scratch(exec_scratch& scratch, const exec_plan& plan) {
+        size_t m = plan.m;
+        if (_reduce_row && !_reduce_direct) {
+            size_t size = m * _N_block_num * _reduce_slots;
+            if (scratch.reduce_val.size() < size) {
+                scratch.reduce_val.resize(size);
+                scratch.reduce_idx.resize(size);
+            }
+            size_t stat_size = m * get_row_stat_slots();
+            if (_norm_two_pass && scratch.row_stat.size() < stat_size)
+                scratch.row_stat.resize(stat_size);
+        }
+        if (_quant) {
+            int nthr = std::max(plan.nthread, _numa_threads);
+            if (scratch.a_quant.size() < static_cast<size_t>(nthr)) {
+                scratch.a_quant.resize(nthr);
+                scratch.a_scale.resize(nthr);
+            }
+            for (int i = 0; i < nthr; i++) {
+                if (scratch.a_quant[i].size() < static_cast<size_t>(plan.M) * _K4) {
+                    scratch.a_quant[i].resize(static_cast<size_t>(plan.M) * _K4);
+                    scratch.a_scale[i].resize(plan.M);
+                }
+            }
+        }
+    }
+
+    // plans of the hot M values and every scratch sized for them, so their first calls do not allocate
+    void init_hot_m() {
+        for (auto hot_m : _dynMStaticParam.hot_m) {
+            if (hot_m <= 0)
+                continue;
+            exec_plan local;
+            auto& plan = *get_plan(hot_m, _nthread, local);
+            _scratch.for_each([&](exec_scratch& scratch) { reserve_scratch(scratch, plan); });
+        }
+    }
+
+    void measure_wake() {
+        if (_nthread <= 1)
+            return;
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        auto it = wake_cache.find(_nthread);
+        if (it != wake_cache.end()) {
+            _wake_ns = it->second;
+            return;
+        }
+        std::vector<double> times;
+        for (int i = 0; i < 5; i++) {
+            // let the workers fall asleep as they do between two calls
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            auto start = std::chrono::steady_clock::now();
+            parallel(_nthread, [](const int, const int) {});
+            auto end = std::chrono::steady_clock::now();
+            times.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+        }
+        std::sort(times.begin(), times.end());
+        _wake_ns = times[times.size() / 2];
+        wake_cache[_nthread] = _wake_ns;
+    }
+
+    // threads worth waking for m rows: the time on one thread split over n threads plus a wake up cost
+    // that grows with n, 1 runs inline on the calling thread
+    int get_exec_nthread(int m, int nthread) {
+        if (_dynMStaticParam.schedule.all_threads || nthread <= 1 || _wake_ns <= 0)
+            return nthread;
+        // rough rates of one avx512 core, int8 vnni does four times the multiplies
+        const double flops_per_ns = _quant ? 200 : 50;
+        const double bytes_per_ns = 10;
+        auto& p = _dynMStaticParam;
+        double flops = 2.0 * m * p.N * p.K;
+        double bytes = static_cast<double>(m) * (p.K + p.N) * sizeof(float) +
+            static_cast<double>(p.K) * p.N * (_quant ? 1 : sizeof(float));
+        double one = flops / flops_per_ns + bytes / bytes_per_ns;
+        double wake = _wake_ns / _nthread;
+        // minimum of one / n + wake * n
+        int n = static_cast<int>(std::sqrt(one / wake));
+        n = std::max(1, std::min(n, nthread));
+        // every thread needs a block, M blocks have at least 8 rows
+        n = std::min(n, (m + 7) / 8 * _N_block_num);
+        if (n > 1 && one / n + wake * n >= one)
+            n = 1;
+        return n;
+    }
+
+    int get_M_block(int M, int nthread) {
         // max m block that fits in L2
         auto N_block = _N_block ? _N_block : _N_block_tail;
         auto B_size = N_block * _dynMStaticParam.K;
@@ -65,14 +639,14 @@ struct matmul::matmul_impl {
         auto AC_lines = static_cast<int>((_L2 - B_size) / sizeof(float) * 8 / AC_line_size / 10);
 
         // at least m block for each threads
-        auto M_block_thread = M / (_nthread * _N_block_num);
+        auto M_block_thread = M / (nthread * _N_block_num);
         // prevent too small M block
         M_block_thread = std::max(M_block_thread, 8);
         auto M_block_init = std::min(M_block_thread, AC_lines);
         auto M_block = M_block_init;
         bool find = false;
         for (; M_block >= 8; M_block--) {
-            if (M % M_block == 0 && M_block % 8 == 0 && (M / M_block * _N_block_num % _nthread == 0)) {
+            if (M % M_block == 0 && M_block % 8 == 0 && (M / M_block * _N_block_num % nthread == 0)) {
                 find = true;
                 break;
             }
@@ -98,56 +672,420 @@ struct matmul::matmul_impl {
         return find ? M_block : M_block_init;
     }
 
-    void init_postops_offset(int ocb, int n_block, GemmDynMRuntimeParam &param, const GemmDynMRuntimeParam& orgParam) {
+    void init_postops_offset(int osb, int m_block, int ocb, int n_block, GemmDynMRuntimeParam &param, const GemmDynMRuntimeParam& orgParam) {
         for (int i = 0; i < _dynMStaticParam.post_static_params.num; i++) {
-            if (_dynMStaticParam.post_static_params.ops[i].alg_type >= AlgType::Add &&
-                _dynMStaticParam.post_static_params.ops[i].binary_param.layout == BinaryDataLayout::PerChannel) {
+            auto& op = _dynMStaticParam.post_static_params.ops[i];
+            if (op.alg_type < AlgType::Add)
+                continue;
+            if (op.binary_param.layout == BinaryDataLayout::PerChannel) {
                 param.post_runtime_params.params[i].right_addr = orgParam.post_runtime_params.params[i].right_addr + ocb * n_block;
+            } else if (op.binary_param.layout == BinaryDataLayout::PerElement) {
+                int ld = (op.binary_param.ld ? op.binary_param.ld : _dynMStaticParam.ldc) / sizeof(float);
+                param.post_runtime_params.params[i].right_addr = orgParam.post_runtime_params.params[i].right_addr +
+                    static_cast<size_t>(osb) * m_block * ld + ocb * n_block;
             }
         }
     }
 
+    int get_block_width(int ocb) {
+        return (ocb == _N_block_num - 1 && _N_block_tail) ? _N_block_tail : _N_block;
+    }
+
+    // merge the partial row reductions of all N blocks into out_val/out_idx
+    void combine_row_reduce(const exec_scratch& scratch, int M, float* out_vals, int* out_idxs, int out_ld) {
+        auto& row_reduce = _row_reduce;
+        auto alg = row_reduce.alg;
+        int row_ld = _reduce_slots * _N_block_num;
+        parallel_rows(M, [&](dim_t m) {
+            const float* val = scratch.reduce_val.data() + m * row_ld;
+            const int* idx = scratch.reduce_idx.data() + m * row_ld;
+            float* out_val = out_vals + m * out_ld;
+            switch (alg) {
+                case RowReduceAlg::Sum: {
+                    float sum = 0;
+                    for (int b = 0; b < _N_block_num; b++)
+                        sum += val[b * _reduce_slots];
+                    out_val[0] = sum;
+                    break;
+                }
+                case RowReduceAlg::Max: {
+                    float max = val[0];
+                    for (int b = 1; b < _N_block_num; b++)
+                        max = std::max(max, val[b * _reduce_slots]);
+                    out_val[0] = max;
+                    break;
+                }
+                case RowReduceAlg::ArgMax:
+                case RowReduceAlg::TopK: {
+                    // insertion into the sorted output, strict compare keeps the first column of equal values
+                    int* out_idx = out_idxs + m * out_ld;
+                    int k = alg == RowReduceAlg::TopK ? row_reduce.k : 1;
+                    int num = 0;
+                    for (int b = 0; b < _N_block_num; b++) {
+                        int block_k = (b == _N_block_num - 1 && _N_block_tail) ? std::min(k, _N_block_tail) : k;
+                        for (int r = 0; r < block_k; r++) {
+                            float v = val[b * _reduce_slots + r];
+                            if (num == k && !(v > out_val[k - 1]))
+                                break;
+                            if (num < k)
+                                num++;
+                            int pos = num - 1;
+                            for (; pos > 0 && v > out_val[pos - 1]; pos--) {
+                                out_val[pos] = out_val[pos - 1];
+                                out_idx[pos] = out_idx[pos - 1];
+                            }
+                            out_val[pos] = v;
+                            out_idx[pos] = idx[b * _reduce_slots + r] + b * _N_block;
+                        }
+                    }
+                    break;
+                }
+                case RowReduceAlg::LogSumExp: {
+                    float max = val[0];
+                    for (int b = 1; b < _N_block_num; b++)
+                        max = std::max(max, val[b * _reduce_slots]);
+                    float sum = 0;
+                    for (int b = 0; b < _N_block_num; b++)
+                        sum += val[b * _reduce_slots + 1] * std::exp(val[b * _reduce_slots] - max);
+                    out_val[0] = max + std::log(sum);
+                    break;
+                }
+                case RowReduceAlg::Moments: {
+                    // Chan's parallel variance, each block holds its own mean and variance
+                    float mean = 0;
+                    for (int b = 0; b < _N_block_num; b++)
+                        mean += val[b * _reduce_slots] * get_block_width(b);
+                    mean /= _dynMStaticParam.N;
+                    float m2 = 0;
+                    for (int b = 0; b < _N_block_num; b++) {
+                        float diff = val[b * _reduce_slots] - mean;
+                        m2 += (val[b * _reduce_slots + 1] + diff * diff) * get_block_width(b);
+                    }
+                    out_val[0] = mean;
+                    out_val[1] = m2 / _dynMStaticParam.N;
+                    break;
+                }
+                case RowReduceAlg::SumSquare: {
+                    float sum = 0;
+                    for (int b = 0; b < _N_block_num; b++)
+                        sum += val[b * _reduce_slots];
+                    out_val[0] = sum;
+                    break;
+                }
+                default:
+                    break;
+            }
+        });
+    }
+
+    int get_row_stat_slots() {
+        return _row_reduce.alg == RowReduceAlg::Moments ? 2 : 1;
+    }
+
+    // second pass of the row normalization, row_stat holds the statistics of each row
+    void norm_rows(const exec_scratch& scratch, const GemmDynMRuntimeParam& runtime_param) {
+        auto alg = _dynMStaticParam.row_norm.alg;
+        auto N = _dynMStaticParam.N;
+        auto eps = _dynMStaticParam.row_norm.eps;
+        int slots = get_row_stat_slots();
+        const float* gamma = runtime_param.post_runtime_params.norm_gamma;
+        const float* beta = runtime_param.post_runtime_params.norm_beta;
+        parallel_rows(runtime_param.m, [&](dim_t m) {
+            float* c = reinterpret_cast<float*>(static_cast<uint8_t*>(runtime_param.c) + m * _dynMStaticParam.ldc);
+            const float* stat = scratch.row_stat.data() + m * slots;
+            switch (alg) {
+                case RowNormAlg::Softmax:
+                    for (int n = 0; n < N; n++)
+                        c[n] = std::exp(c[n] - stat[0]);
+                    break;
+                case RowNormAlg::LogSoftmax:
+                    for (int n = 0; n < N; n++)
+                        c[n] -= stat[0];
+                    break;
+                case RowNormAlg::LayerNorm: {
+                    float inv_std = 1.0f / std::sqrt(stat[1] + eps);
+                    for (int n = 0; n < N; n++)
+                        c[n] = (c[n] - stat[0]) * inv_std * gamma[n] + beta[n];
+                    break;
+                }
+                case RowNormAlg::RMSNorm: {
+                    float inv_rms = 1.0f / std::sqrt(stat[0] / N + eps);
+                    for (int n = 0; n < N; n++)
+                        c[n] = c[n] * inv_rms * gamma[n];
+                    break;
+                }
+                default:
+                    break;
+            }
+        });
+    }
+
     void exec(const GemmDynMRuntimeParam& runtime_param) {
-        auto M = get_M_block(runtime_param.m);
-        auto M_tail = runtime_param.m % M;
-        auto M_block = (runtime_param.m + M - 1) / M;
-        int work_amount = M_block * _N_block_num;
-        bool loopN = runtime_param.m > _dynMStaticParam.N;
+        auto context = runtime_param.context ? runtime_param.context : _dynMStaticParam.context;
+        if (context) {
+            auto body = [&] { exec_in(runtime_param, context->nthread(), false); };
+            context->execute([ref = &body] { (*ref)(); });
+        } else
+            exec_in(runtime_param, _nthread, true);
+    }
+
+    exec_plan make_plan(int m, int nthread) {
+        exec_plan plan;
+        plan.m = m;
+        plan.nthread_in = nthread;
+        plan.nthread = get_exec_nthread(m, nthread);
+        plan.M = get_M_block(m, plan.nthread);
+        plan.M_tail = m % plan.M;
+        plan.M_block = (m + plan.M - 1) / plan.M;
+        plan.work_amount = plan.M_block * _N_block_num;
+        plan.loopN = m > _dynMStaticParam.N;
+        if (!_fixed_kernels.empty()) {
+            auto it = _fixed_kernels.find(plan.M);
+            if (it != _fixed_kernels.end())
+                plan.fixed_block = it->second.funcs;
+            it = _fixed_kernels.find(plan.M_tail);
+            if (plan.M_tail && it != _fixed_kernels.end())
+                plan.fixed_tail = it->second.funcs;
+        }
+        return plan;
+    }
+
+    // first slot of m: the top 8 bits of the multiplicative hash, the low ones are the same for all
+    // multiples of 256
+    static unsigned get_plan_slot(int m) {
+        static_assert(plan_slots == 256, "the slot is 8 bits of the hash");
+        return (static_cast<unsigned>(m) * 2654435761u) >> 24;
+    }
+
+    // the cached plan of m or nullptr, never builds one
+    const exec_plan* find_plan(int m, int nthread) {
+        auto slot = get_plan_slot(m);
+        for (int i = 0; i < plan_probes; i++) {
+            auto plan = _plans[(slot + i) % plan_slots].load(std::memory_order_acquire);
+            if (!plan)
+                return nullptr;
+            if (plan->m == m && plan->nthread_in == nthread)
+                return plan;
+        }
+        return nullptr;
+    }
+
+    // the cached plan of m, or a plan built into local when its probe window is full
+    const exec_plan* get_plan(int m, int nthread, exec_plan& local) {
+        auto slot = get_plan_slot(m);
+        for (int i = 0; i < plan_probes; i++) {
+            auto& entry = _plans[(slot + i) % plan_slots];
+            auto plan = entry.load(std::memory_order_acquire);
+            if (!plan) {
+                auto fresh = new exec_plan(make_plan(m, nthread));
+                if (entry.compare_exchange_strong(plan, fresh, std::memory_order_acq_rel))
+                    return fresh;
+                // another thread took the slot, plan is its entry
+                delete fresh;
+            }
+            if (plan->m == m && plan->nthread_in == nthread)
+                return plan;
+        }
+        local = make_plan(m, nthread);
+        return &local;
+    }
 
-        parallel(_nthread, [&](const int ithr, const int nthr) {
-            if (ithr >= work_amount) return;
+    void clear_plans() {
+        for (auto& entry : _plans)
+            delete entry.exchange(nullptr);
+    }
+
+    // drops everything a previous init derived from its params, the scratch buffers are kept since they only grow
+    void reset() {
+        clear_plans();
+        _kernels.clear();
+        _funcs = {};
+        _fixed_kernels.clear();
+        _stream_kernels.clear();
+        _stream_funcs = {};
+        _aligned_kernels.clear();
+        _aligned_funcs = {};
+        _sparse_kernels.clear();
+        _sparse_funcs.clear();
+        _N_block_tail = 0;
+        _reduce_row = false;
+        _reduce_direct = false;
+        _reduce_slots = 0;
+        _norm_two_pass = false;
+        _quant = false;
+        _K4 = 0;
+        _b_quant.clear();
+        _b_scale.clear();
+        _b_comp.clear();
+#if DNNL_CPU_THREADING_RUNTIME == DNNL_RUNTIME_TBB
+        _numa_nodes.clear();
+#endif
+        _numa_b = nullptr;
+        _numa_threads = 0;
+    }
 
+    // nthread threads of the current arena, the NUMA arenas are only used outside of a context
+    void exec_in(const GemmDynMRuntimeParam& runtime_param, int nthread, bool use_numa) {
+        exec_plan local;
+        auto& plan = *get_plan(runtime_param.m, nthread, local);
+        use_numa = use_numa && plan.nthread == nthread;
+        nthread = plan.nthread;
+        auto M = plan.M;
+        auto M_tail = plan.M_tail;
+        auto M_block = plan.M_block;
+        int work_amount = plan.work_amount;
+        bool loopN = plan.loopN;
+        auto& fixed_block = plan.fixed_block;
+        auto& fixed_tail = plan.fixed_tail;
+        auto lease = _scratch.acquire();
+        auto& scratch = *lease;
+        reserve_scratch(scratch, plan);
+        bool stream_c = use_stream_c(runtime_param);
+        bool aligned = !stream_c && use_aligned(runtime_param, _quant ? _b_quant.data() : runtime_param.b);
+        const void* b = _quant ? static_cast<const void*>(_b_quant.data()) : runtime_param.b;
+
+        // ithr only picks the quantization buffer, it must be unique among all running threads
+        auto work = [&](const int ithr, int start, int end, const uint8_t* b, int& quant_osb) {
             GemmDynMRuntimeParam param = runtime_param;
-            int start, end;
-            balance211(work_amount, nthr, ithr, start, end);
             int ocb {0}, osb {0};
             if (loopN)
                 nd_iterator_init(start, osb, M_block, ocb, _N_block_num);
             else
                 nd_iterator_init(start, ocb, _N_block_num, osb, M_block);
             while (start++ < end) {
-                init_postops_offset(ocb, _N_block, param, runtime_param);
+                init_postops_offset(osb, M, ocb, _N_block, param, runtime_param);
                 param.a = static_cast<uint8_t*>(runtime_param.a) + osb * M * _dynMStaticParam.lda;
-                param.b = static_cast<uint8_t*>(runtime_param.b) + ocb * _N_block * sizeof(float);
-                param.c = static_cast<uint8_t*>(runtime_param.c) + osb * M * _dynMStaticParam.ldc + ocb * _N_block * sizeof(float);
+                param.b = const_cast<uint8_t*>(b) + ocb * _N_block * sizeof(float);
+                if (_dynMStaticParam.c_store_mode == CStoreMode::Normal) {
+                    param.c = static_cast<uint8_t*>(runtime_param.c) + osb * M * _dynMStaticParam.ldc + ocb * _N_block * sizeof(float);
+                } else {
+                    // rows are located by the index array, c only moves along N
+                    param.c = static_cast<uint8_t*>(runtime_param.c) + ocb * _N_block * sizeof(float);
+                    param.post_runtime_params.c_row_index = runtime_param.post_runtime_params.c_row_index + osb * M;
+                    param.post_runtime_params.c_row_scale = runtime_param.post_runtime_params.c_row_scale + osb * M;
+                }
+                if (_reduce_row) {
+                    auto& ops = param.post_runtime_params;
+                    auto& org_ops = runtime_param.post_runtime_params;
+                    if (_reduce_direct) {
+                        auto& row_reduce = _row_reduce;
+                        int ld = row_reduce.ld ? row_reduce.ld : _reduce_slots;
+                        ops.row_reduce_val = org_ops.row_reduce_val + osb * M * ld;
+                        if (row_reduce.alg == RowReduceAlg::ArgMax || row_reduce.alg == RowReduceAlg::TopK)
+                            ops.row_reduce_idx = org_ops.row_reduce_idx + osb * M * ld;
+                    } else {
+                        size_t offset = (static_cast<size_t>(osb) * M * _N_block_num + ocb) * _reduce_slots;
+                        ops.row_reduce_val = scratch.reduce_val.data() + offset;
+                        ops.row_reduce_idx = scratch.reduce_idx.data() + offset;
+                    }
+                }
                 if (osb == M_block - 1 && M_tail)
                     param.m = M_tail;
                 else
                     param.m = M;
-                if (ocb == _N_block_num - 1 && _N_block_tail)
-                    _kernels[_N_block_tail](param);
+                if (_quant) {
+                    // the M block is quantized once per thread while it stays, the kernel reads it from cache
+                    if (osb != quant_osb) {
+                        QuantizeRuntimeParam quant_param = {
+                            param.m, static_cast<uint8_t*>(runtime_param.a) + osb * M * _dynMStaticParam.lda,
+                            scratch.a_quant[ithr].data(), scratch.a_scale[ithr].data()
+                        };
+                        _quantize(quant_param);
+                        quant_osb = osb;
+                    }
+                    auto& ops = param.post_runtime_params;
+                    param.a = scratch.a_quant[ithr].data();
+                    param.b = const_cast<uint8_t*>(b) + ocb * _N_block * 4;
+                    ops.a_scale = scratch.a_scale[ithr].data();
+                    ops.b_scale = _b_scale.data() + ocb * _N_block;
+                    ops.b_comp = _b_comp.data() + ocb * _N_block;
+                }
+                auto& fixed = (osb == M_block - 1 && M_tail) ? fixed_tail : fixed_block;
+                auto& funcs = stream_c ? _stream_funcs : fixed.block ? fixed : aligned ? _aligned_funcs : _funcs;
+                gemm_func_t func;
+                if (!_sparse_funcs.empty())
+                    func = _sparse_funcs[ocb];
                 else
-                    _kernels[_N_block](param);
+                    func = ocb == _N_block_num - 1 && _N_block_tail ? funcs.tail : funcs.block;
+                func(param.m, static_cast<uint8_t*>(param.a), static_cast<uint8_t*>(param.b), static_cast<uint8_t*>(param.c),
+                    &param.post_runtime_params);
 
                 if (loopN)
                     nd_iterator_step(osb, M_block, ocb, _N_block_num);
                 else
                     nd_iterator_step(ocb, _N_block_num, osb, M_block);
             }
-        });
+        };
+        // splits [begin, end) among the nthr threads of one parallel region, counter is shared by them
+        int chunk = _dynMStaticParam.schedule.chunk ? _dynMStaticParam.schedule.chunk : 1;
+        auto run = [&](const int buf_ithr, const int ithr, const int nthr, int begin, int end,
+                std::atomic<int>& counter, const uint8_t* b) {
+            int quant_osb = -1;
+            if (!_dynamic) {
+                int start, stop;
+                balance211(end - begin, nthr, ithr, start, stop);
+                if (start < stop)
+                    work(buf_ithr, begin + start, begin + stop, b, quant_osb);
+                return;
+            }
+            // blocks of one grab are consecutive, with loopN they mostly share the M block and its quantized A
+            for (;;) {
+                int start = begin + counter.fetch_add(chunk, std::memory_order_relaxed);
+                if (start >= end)
+                    break;
+                work(buf_ithr, start, std::min(start + chunk, end), b, quant_osb);
+            }
+        };
+#if DNNL_CPU_THREADING_RUNTIME == DNNL_RUNTIME_TBB
+        if (use_numa && _numa_b && _numa_b == b) {
+            // every node takes a contiguous share of the work, so mostly whole M blocks, and splits it
+            // among its own threads
+            int node_num = static_cast<int>(_numa_nodes.size());
+            tbb::task_group groups[max_numa_nodes];
+            std::atomic<int> counters[max_numa_nodes] = {};
+            for (int i = 0; i < node_num; i++) {
+                int node_start, node_end;
+                balance211(work_amount, node_num, i, node_start, node_end);
+                if (node_start >= node_end) continue;
+                // the task runs after the loop moved on, it takes its node and counter by value
+                auto node = &_numa_nodes[i];
+                auto counter = &counters[i];
+                node->arena->execute([&, i, node, counter, node_start, node_end] {
+                    groups[i].run([&, node, counter, node_start, node_end] {
+                        auto body = [&](const int ithr, const int nthr) {
+                            run(node->thread_offset + ithr, ithr, nthr, node_start, node_end, *counter, node->b);
+                        };
+                        parallel_ref(0, body);
+                    });
+                });
+            }
+            for (int i = 0; i < node_num; i++)
+                _numa_nodes[i].arena->execute([&] { groups[i].wait(); });
+        } else
+#endif
+        {
+            std::atomic<int> counter(0);
+            auto body = [&](const int ithr, const int nthr) {
+                if (ithr >= work_amount) return;
+                run(ithr, ithr, nthr, 0, work_amount, counter, static_cast<const uint8_t*>(b));
+            };
+            parallel_ref(nthread, body);
+        }
+        if (_reduce_row && !_reduce_direct) {
+            if (_norm_two_pass) {
+                int slots = get_row_stat_slots();
+                combine_row_reduce(scratch, runtime_param.m, scratch.row_stat.data(), nullptr, slots);
+                norm_rows(scratch, runtime_param);
+            } else {
+                auto& ops = runtime_param.post_runtime_params;
+                int out_slots = _row_reduce.alg == RowReduceAlg::LogSumExp ? 1 : _reduce_slots;
+                combine_row_reduce(scratch, runtime_param.m, ops.row_reduce_val, ops.row_reduce_idx,
+                    _row_reduce.ld ? _row_reduce.ld : out_slots);
+            }
+        }
     }
     ~matmul_impl() {
-
+        clear_plans();
     }
 };
 
@@ -163,5 +1101,24 @@ void matmul::operator()(const GemmDynMRuntimeParam& runtime_param) {
     _impl->exec(runtime_param);
 }
 
+GemmExecInfo get_exec_info(const matmul& gemm, int m) {
+    auto& impl = *gemm._impl;
+    auto context = impl._dynMStaticParam.context;
+    int nthread = context ? context->nthread() : impl._nthread;
+    GemmExecInfo info;
+    info.cached = impl.find_plan(m, nthread) != nullptr;
+    matmul::matmul_impl::exec_plan local;
+    auto& plan = *impl.get_plan(m, nthread, local);
+    info.nthread = plan.nthread;
+    info.nthread_max = nthread;
+    info.M_block = plan.M;
+    info.work_amount = plan.work_amount;
+    info.dynamic = impl._dynamic;
+#if DNNL_CPU_THREADING_RUNTIME == DNNL_RUNTIME_TBB
+    info.numa_nodes = static_cast<int>(impl._numa_nodes.size());
+#endif
+    return info;
+}
+
 
 }
\ No newline at end of file
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "boat.h"
+
+namespace boat {
+
+// how an initialized matmul runs a call of m rows outside of a context, for tests and benchmarks
+struct GemmExecInfo {
+    int nthread = 0;        // threads the call wakes
+    int nthread_max = 0;    // threads of the arena the call runs in
+    int M_block = 0;        // rows of an M block
+    int work_amount = 0;    // M blocks times N blocks
+    bool dynamic = false;   // threads take blocks from a shared counter
+    int numa_nodes = 0;     // arenas holding a copy of B, 0 without replication
+    bool cached = false;    // a call or query of m rows before this one left its plan in the table
+};
+GemmExecInfo get_exec_info(const matmul& gemm, int m);
+
+};
@@ -0,0 +1,309 @@
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include <assert.h>
+#include <limits>
+
+#include <coat/Function.h>
+#include <coat/ControlFlow.h>
+#include <coat/Vec.h>
+#include "dnnl_thread.hpp"
+#include "boat.h"
+#include "jit_math.h"
+
+#define ENABLE_DUMP 0
+
+using namespace dnnl::impl;
+using namespace dnnl::impl::utils;
+
+namespace boat {
+
+//
+// N is known at jit time, every row is visited in a few passes:
+//   Softmax:    max, sum(exp(x - max)) storing exp, scale by 1 / sum
+//   LogSoftmax: max, sum(exp(x - max)), x - max - log(sum)
+//   LayerNorm:  mean, variance, (x - mean) / sqrt(var + eps) * gamma + beta
+//   RMSNorm:    mean square, x / sqrt(ms + eps) * gamma
+// each pass handles unroll vectors per iteration with their own accumulators, the N tail uses k1
+//
+using norm_func_t = void (*)(int m, float* src, float* dst, float* gamma, float* beta);
+template <unsigned width>
+static norm_func_t make_norm(const NormStaticParam& static_param) {
+    static_assert(width == 16, "log needs avx512");
+    int N = static_param.N;
+    int ld_src = static_param.ld_src / sizeof(float);
+    int ld_dst = static_param.ld_dst / sizeof(float);
+    auto alg = static_param.alg;
+    if (N <= 0 || alg == RowNormAlg::None) {
+        std::cout << "norm needs N > 0 and an algorithm" << std::endl;
+        return nullptr;
+    }
+    auto fn = coat::createFunction<norm_func_t>("norm");
+    fn.funcNode->frame().setAvx512Enabled();
+#if ENABLE_DUMP
+    fn.enableCodeDump();
+#endif
+    const int unroll = 4;
+    int vec_num = N / width;
+    int group_num = vec_num / unroll;
+    bool has_n_tail = (N % width) != 0;
+    bool use_gamma = alg == RowNormAlg::LayerNorm || alg == RowNormAlg::RMSNorm;
+    bool use_beta = alg == RowNormAlg::LayerNorm;
+    {
+        if (has_n_tail) {
+            coat::Value<int> j_mask((1 << (N % width)) - 1);
+            _CC.kmovq(asmjit::x86::k1, j_mask);
+        }
+        auto [j_M, j_src, j_dst, j_gamma, j_beta] = fn.getArguments("m", "src", "dst", "gamma", "beta");
+        std::vector<share_vec<width>> j_acc;
+        for (int i = 0; i < unroll; i++)
+            j_acc.push_back(std::make_shared<coat::Vec<float, width>>());
+        coat::Vec<float, width> j_x, j_tmp, j_stat, j_scale, j_mean, j_lowest;
+
+        // calls body(j_s, j_d, j_g, j_b, offset, acc index, masked) for every vector of the row
+        auto row_loop = [&] (auto body) {
+            auto j_s = j_src;
+            auto j_d = j_dst;
+            auto j_g = j_gamma;
+            auto j_b = j_beta;
+            if (group_num > 0) {
+                coat::Value<int> j_i(int(0), "i");
+                coat::for_loop(j_i < group_num,
+                    [&] {
+                        j_i += 1;
+                        j_s += unroll * width;
+                        j_d += unroll * width;
+                        if (use_gamma)
+                            j_g += unroll * width;
+                        if (use_beta)
+                            j_b += unroll * width;
+                    },
+                    [&] {
+                        for (int u = 0; u < unroll; u++)
+                            body(j_s, j_d, j_g, j_b, u * width, u, false);
+                    });
+            }
+            for (int u = 0; u < vec_num % unroll; u++)
+                body(j_s, j_d, j_g, j_b, u * width, u, false);
+            if (has_n_tail)
+                body(j_s, j_d, j_g, j_b, (vec_num % unroll) * width, vec_num % unroll, true);
+        };
+        // sum or max of all accumulators, broadcast to j_stat
+        auto reduce_acc = [&] (bool is_max) {
+            j_stat = *j_acc[0];
+            for (int u = 1; u < unroll; u++) {
+                if (is_max)
+                    j_stat.max_(*j_acc[u]);
+                else
+                    j_stat.add(*j_acc[u]);
+            }
+            jit_reduce<width>(j_stat, is_max);
+        };
+        auto reset_acc = [&] (bool is_max) {
+            for (int u = 0; u < unroll; u++) {
+                if (is_max)
+                    *j_acc[u] = j_lowest;
+                else
+                    *j_acc[u] = 0;
+            }
+        };
+        auto load = [&] (coat::wrapper_type<float*>& j_p, int offset, bool masked) {
+            if (masked)
+                j_x.kzload(j_p[offset], asmjit::x86::k1);
+            else
+                j_x.load(j_p[offset]);
+        };
+        auto store = [&] (coat::wrapper_type<float*>& j_p, int offset, bool masked) {
+            if (masked)
+                j_x.kstore(j_p[offset], asmjit::x86::k1);
+            else
+                j_x.store(j_p[offset]);
+        };
+        // x = x * j_scale * gamma (+ beta)
+        auto affine = [&] (coat::wrapper_type<float*>& j_g, coat::wrapper_type<float*>& j_b, int offset, bool masked) {
+            j_x.mul(j_scale);
+            if (masked) {
+                j_tmp.kzload(j_g[offset], asmjit::x86::k1);
+                j_x.mul(j_tmp);
+                if (use_beta) {
+                    j_tmp.kzload(j_b[offset], asmjit::x86::k1);
+                    j_x.add(j_tmp);
+                }
+            } else {
+                j_x.mul(j_g[offset]);
+                if (use_beta)
+                    j_x.add(j_b[offset]);
+            }
+        };
+        // j_scale = 1 / sqrt(j_stat / N + eps)
+        auto rsqrt = [&] {
+            j_tmp = 1.0f / N;
+            j_stat.mul(j_tmp);
+            j_tmp = static_param.eps;
+            j_stat.add(j_tmp);
+            _CC.vsqrtps(j_stat.reg, j_stat.reg);
+            j_scale = 1.0f;
+            j_scale.div(j_stat);
+        };
+
+        j_lowest = std::numeric_limits<float>::lowest();
+        coat::Value<int> j_m(int(0), "m");
+        coat::for_loop(j_m < j_M,
+        [&] {
+            j_m += 1;
+            j_src += ld_src;
+            j_dst += ld_dst;
+        },
+        [&] {
+            switch (alg) {
+                case RowNormAlg::Softmax:
+                case RowNormAlg::LogSoftmax: {
+                    reset_acc(true);
+                    row_loop([&] (auto& j_s, auto&, auto&, auto&, int offset, int u, bool masked) {
+                        if (masked) {
+                            j_x = j_lowest;
+                            _CC.k(asmjit::x86::k1).vmovups(j_x.reg, j_s[offset]);
+                        } else {
+                            j_x.load(j_s[offset]);
+                        }
+                        j_acc[u]->max_(j_x);
+                    });
+                    reduce_acc(true);
+                    j_scale = j_stat;
+                    reset_acc(false);
+                    row_loop([&] (auto& j_s, auto& j_d, auto&, auto&, int offset, int u, bool masked) {
+                        load(j_s, offset, masked);
+                        j_x.sub(j_scale);
+                        jit_exp<width>(j_x);
+                        if (masked)
+                            _CC.k(asmjit::x86::k1).z().vmovaps(j_x.reg, j_x.reg);
+                        j_acc[u]->add(j_x);
+                        if (alg == RowNormAlg::Softmax)
+                            store(j_d, offset, masked);
+                    });
+                    reduce_acc(false);
+                    if (alg == RowNormAlg::Softmax) {
+                        j_tmp = 1.0f;
+                        j_tmp.div(j_stat);
+                        j_scale = j_tmp;
+                        row_loop([&] (auto&, auto& j_d, auto&, auto&, int offset, int, bool masked) {
+                            load(j_d, offset, masked);
+                            j_x.mul(j_scale);
+                            store(j_d, offset, masked);
+                        });
+                    } else {
+                        // log(sum) + max
+                        jit_log<width>(j_stat);
+                        j_scale.add(j_stat);
+                        row_loop([&] (auto& j_s, auto& j_d, auto&, auto&, int offset, int, bool masked) {
+                            load(j_s, offset, masked);
+                            j_x.sub(j_scale);
+                            store(j_d, offset, masked);
+                        });
+                    }
+                    break;
+                }
+                case RowNormAlg::LayerNorm: {
+                    reset_acc(false);
+                    row_loop([&] (auto& j_s, auto&, auto&, auto&, int offset, int u, bool masked) {
+                        load(j_s, offset, masked);
+                        j_acc[u]->add(j_x);
+                    });
+                    reduce_acc(false);
+                    j_tmp = 1.0f / N;
+                    j_stat.mul(j_tmp);
+                    j_mean = j_stat;
+                    reset_acc(false);
+                    row_loop([&] (auto& j_s, auto&, auto&, auto&, int offset, int u, bool masked) {
+                        load(j_s, offset, masked);
+                        j_x.sub(j_mean);
+                        if (masked)
+                            _CC.k(asmjit::x86::k1).z().vmovaps(j_x.reg, j_x.reg);
+                        j_acc[u]->fma231(j_x, j_x);
+                    });
+                    reduce_acc(false);
+                    rsqrt();
+                    row_loop([&] (auto& j_s, auto& j_d, auto& j_g, auto& j_b, int offset, int, bool masked) {
+                        load(j_s, offset, masked);
+                        j_x.sub(j_mean);
+                        affine(j_g, j_b, offset, masked);
+                        store(j_d, offset, masked);
+                    });
+                    break;
+                }
+                case RowNormAlg::RMSNorm: {
+                    reset_acc(false);
+                    row_loop([&] (auto& j_s, auto&, auto&, auto&, int offset, int u, bool masked) {
+                        load(j_s, offset, masked);
+                        j_acc[u]->fma231(j_x, j_x);
+                    });
+                    reduce_acc(false);
+                    rsqrt();
+                    row_loop([&] (auto& j_s, auto& j_d, auto& j_g, auto& j_b, int offset, int, bool masked) {
+                        load(j_s, offset, masked);
+                        affine(j_g, j_b, offset, masked);
+                        store(j_d, offset, masked);
+                    });
+                    break;
+                }
+                default:
+                    break;
+            }
+        });
+        // specify return value
+        coat::ret();
+    }
+
+    // finalize code generation and get function pointer to the generated function
+    auto foo = fn.finalize();
+    return foo;
+}
+
+struct norm::norm_impl {
+    norm_func_t _func = nullptr;
+    int _nthread = 0;
+    NormStaticParam _static_param;
+
+    bool init(const NormStaticParam& static_param) {
+        if (static_param.data_type != dnnl_f32)
+            return false;
+        _nthread = dnnl_get_max_threads();
+        _static_param = static_param;
+        _func = make_norm<16>(static_param);
+        return _func != nullptr;
+    }
+
+    void exec(const NormRuntimeParam& runtime_param) {
+        assert(_func);
+        // rows of one thread are contiguous
+        parallel(_nthread, [&](const int ithr, const int nthr) {
+            int start, end;
+            balance211(runtime_param.m, nthr, ithr, start, end);
+            if (start >= end) return;
+            auto src = static_cast<uint8_t*>(runtime_param.src) + static_cast<size_t>(start) * _static_param.ld_src;
+            auto dst = static_cast<uint8_t*>(runtime_param.dst) + static_cast<size_t>(start) * _static_param.ld_dst;
+            _func(end - start, reinterpret_cast<float*>(src), reinterpret_cast<float*>(dst), runtime_param.gamma, runtime_param.beta);
+        });
+    }
+
+    ~norm_impl() {
+        if (_func)
+            coat::getJitRuntimeEnv().release_func(_func);
+    }
+};
+
+norm::norm() :
+    _impl(std::make_shared<norm_impl>()) {
+}
+
+bool norm::init(const NormStaticParam& static_param) {
+    return _impl->init(static_param);
+}
+
+void norm::operator()(const NormRuntimeParam& runtime_param) {
+    _impl->exec(runtime_param);
+}
+
+};
@@ -0,0 +1,171 @@
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include <assert.h>
+
+#include <coat/Function.h>
+#include <coat/ControlFlow.h>
+#include <coat/Vec.h>
+#include "dnnl_thread.hpp"
+#include "boat.h"
+#include "jit_math.h"
+
+#define ENABLE_DUMP 0
+
+using namespace dnnl::impl;
+using namespace dnnl::impl::utils;
+
+namespace boat {
+
+//
+// K is known at jit time, every row is visited twice:
+//   absmax = max(abs(x)), scale = absmax / 127
+//   dst = saturate_u8(round(x * 127 / absmax) + 128)
+// the K tail is loaded with k1 and stored with k2, which also covers the padding up to K rounded to 4
+//
+using quantize_func_t = void (*)(int m, float* src, uint8_t* dst, float* scale);
+template <unsigned width>
+static quantize_func_t make_quantize(const QuantizeStaticParam& static_param) {
+    static_assert(width == 16, "u8 conversion needs avx512");
+    int K = static_param.K;
+    if (K <= 0) {
+        std::cout << "quantize needs K > 0" << std::endl;
+        return nullptr;
+    }
+    int ld_src = static_param.ld_src / sizeof(float);
+    int ld_dst = static_param.ld_dst;
+    auto fn = coat::createFunction<quantize_func_t>("quantize");
+    fn.funcNode->frame().setAvx512Enabled();
+#if ENABLE_DUMP
+    fn.enableCodeDump();
+#endif
+    int K4 = (K + 3) / 4 * 4;
+    int vec_num = K / width;
+    bool has_k_tail = K4 > vec_num * static_cast<int>(width);
+    {
+        if (has_k_tail) {
+            coat::Value<int> j_mask((1 << (K % width)) - 1);
+            _CC.kmovq(asmjit::x86::k1, j_mask);
+            j_mask = static_cast<int>((1u << (K4 - vec_num * width)) - 1);
+            _CC.kmovq(asmjit::x86::k2, j_mask);
+        }
+        auto [j_M, j_src, j_dst, j_scale] = fn.getArguments("m", "src", "dst", "scale");
+        coat::Vec<float, width> j_x, j_max, j_inv, j_abs_mask, j_tmp;
+        coat::Value<int> j_bits(int(0x7fffffff), "abs_bits");
+        _CC.vpbroadcastd(j_abs_mask.reg, j_bits.reg);
+        j_bits = 128;
+        coat::Vec<float, width> j_shift;
+        _CC.vpbroadcastd(j_shift.reg, j_bits.reg);
+
+        // calls body(offset, masked) for every vector of the row
+        auto row_loop = [&] (auto body) {
+            for (int v = 0; v < vec_num; v++)
+                body(v * static_cast<int>(width), false);
+            if (has_k_tail)
+                body(vec_num * static_cast<int>(width), true);
+        };
+
+        coat::Value<int> j_m(int(0), "m");
+        coat::for_loop(j_m < j_M,
+        [&] {
+            j_m += 1;
+            j_src += ld_src;
+            j_dst += ld_dst;
+            j_scale += 1;
+        },
+        [&] {
+            j_max = 0;
+            row_loop([&] (int offset, bool masked) {
+                if (masked)
+                    j_x.kzload(j_src[offset], asmjit::x86::k1);
+                else
+                    j_x.load(j_src[offset]);
+                _CC.vandps(j_x.reg, j_x.reg, j_abs_mask.reg);
+                j_max.max_(j_x);
+            });
+            jit_reduce<width>(j_max, true);
+            j_tmp = 1.0f / 127;
+            j_tmp.mul(j_max);
+            _CC.vmovss(j_scale[0], j_tmp.reg.xmm());
+            // all zero row: a tiny absmax keeps 0 * inv away from nan
+            j_tmp = 1e-30f;
+            j_max.max_(j_tmp);
+            j_inv = 127.0f;
+            j_inv.div(j_max);
+            row_loop([&] (int offset, bool masked) {
+                if (masked)
+                    j_x.kzload(j_src[offset], asmjit::x86::k1);
+                else
+                    j_x.load(j_src[offset]);
+                j_x.mul(j_inv);
+                _CC.vcvtps2dq(j_x.reg, j_x.reg);
+                _CC.vpaddd(j_x.reg, j_x.reg, j_shift.reg);
+                asmjit::x86::Mem mem = j_dst[offset];
+                mem.setSize(width);
+                if (masked)
+                    _CC.k(asmjit::x86::k2).vpmovusdb(mem, j_x.reg);
+                else
+                    _CC.vpmovusdb(mem, j_x.reg);
+            });
+        });
+        // specify return value
+        coat::ret();
+    }
+
+    // finalize code generation and get function pointer to the generated function
+    auto foo = fn.finalize();
+    return foo;
+}
+
+struct quantize::quantize_impl {
+    quantize_func_t _func = nullptr;
+    int _nthread = 0;
+    QuantizeStaticParam _static_param;
+
+    bool init(const QuantizeStaticParam& static_param) {
+        _nthread = dnnl_get_max_threads();
+        _static_param = static_param;
+        _func = make_quantize<16>(static_param);
+        return _func != nullptr;
+    }
+
+    void exec(const QuantizeRuntimeParam& runtime_param) {
+        assert(_func);
+        auto src = static_cast<uint8_t*>(runtime_param.src);
+        auto dst = static_cast<uint8_t*>(runtime_param.dst);
+        size_t bytes = static_cast<size_t>(runtime_param.m) * _static_param.K * sizeof(float);
+        // one M block of matmul is small and the caller is already parallel
+        if (_nthread == 1 || bytes < 256 * 1024) {
+            _func(runtime_param.m, reinterpret_cast<float*>(src), dst, runtime_param.scale);
+            return;
+        }
+        parallel(_nthread, [&](const int ithr, const int nthr) {
+            int start, end;
+            balance211(runtime_param.m, nthr, ithr, start, end);
+            if (start >= end) return;
+            _func(end - start, reinterpret_cast<float*>(src + static_cast<size_t>(start) * _static_param.ld_src),
+                dst + static_cast<size_t>(start) * _static_param.ld_dst, runtime_param.scale + start);
+        });
+    }
+
+    ~quantize_impl() {
+        if (_func)
+            coat::getJitRuntimeEnv().release_func(_func);
+    }
+};
+
+quantize::quantize() :
+    _impl(std::make_shared<quantize_impl>()) {
+}
+
+bool quantize::init(const QuantizeStaticParam& static_param) {
+    return _impl->init(static_param);
+}
+
+void quantize::operator()(const QuantizeRuntimeParam& runtime_param) {
+    _impl->exec(runtime_param);
+}
+
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+namespace boat {
+
+// buffers of one call of a primitive: a call takes a free entry with compare exchange, so concurrent calls
+// never share them; when every entry is taken the call gets a temporary one
+template <typename T, int num = 8>
+class scratch_pool {
+    struct entry {
+        std::atomic<bool> busy {false};
+        T scratch;
+    };
+    std::array<entry, num> _entries;
+
+public:
+    // an entry of the pool until it goes out of scope
+    class lease {
+        friend class scratch_pool;
+        T* _scratch;
+        std::atomic<bool>* _busy = nullptr;
+        std::unique_ptr<T> _spare;
+
+        explicit lease(entry& e) : _scratch(&e.scratch), _busy(&e.busy) {}
+        lease() : _spare(std::make_unique<T>()) {
+            _scratch = _spare.get();
+        }
+
+    public:
+        lease(const lease&) = delete;
+        lease& operator=(const lease&) = delete;
+        ~lease() {
+            if (_busy)
+                _busy->store(false, std::memory_order_release);
+        }
+        T& operator*() const { return *_scratch; }
+        T* operator->() const { return _scratch; }
+    };
+
+    lease acquire() {
+        for (auto& e : _entries) {
+            bool expected = false;
+            if (e.busy.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                return lease(e);
+        }
+        return lease();
+    }
+
+    // every entry, to size them up front; no call may run at the same time
+    template <typename F>
+    void for_each(F f) {
+        for (auto& e : _entries)
+            f(e.scratch);
+    }
+};
+
+};
@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <assert.h>
 #include <algorithm>
+#include <fstream>
 // Required by `__cpuidex()` and `_xgetbv()`.
 #ifdef _WIN32
   #include <intrin.h>
@@ -87,3 +88,36 @@ unsigned int getDataCacheSize(unsigned int level) {
     }
     return dataCacheSize_[level - 1];
 }
+
+std::string getCpuBrand() {
+    unsigned int data[4] = {};
+    getCpuidEx(0x80000000, 0, data);
+    if (data[0] < 0x80000004)
+        return "unknown";
+    char brand[49] = {};
+    for (unsigned int i = 0; i < 3; i++)
+        getCpuidEx(0x80000002 + i, 0, reinterpret_cast<unsigned int*>(brand) + i * 4);
+    std::string ret(brand);
+    // trim the padding spaces
+    ret.erase(0, ret.find_first_not_of(' '));
+    ret.erase(ret.find_last_not_of(' ') + 1);
+    return ret;
+}
+
+bool isHybridCpu() {
+    static const bool hybrid = [] {
+        unsigned int data[4] = {};
+        getCpuidEx(0, 0, data);
+        // CPUID.07H:EDX[15], the hybrid leaf 1AH then tells the kind of the core a thread runs on
+        if (data[0] >= 7) {
+            getCpuidEx(7, 0, data);
+            if (extractBit(data[3], 15, 16))
+                return true;
+        }
+        // a hypervisor may hide the flag, linux still lists the cpus of every core kind in its own pmu
+        std::ifstream core("/sys/devices/cpu_core/cpus"), atom("/sys/devices/cpu_atom/cpus");
+        std::string core_cpus, atom_cpus;
+        return std::getline(core, core_cpus) && std::getline(atom, atom_cpus) && !core_cpus.empty() && !atom_cpus.empty();
+    }();
+    return hybrid;
+}
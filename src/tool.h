@@ -1,3 +1,8 @@
 #pragma once
 
-unsigned int getDataCacheSize(unsigned int level);
\ No newline at end of file
+#include <string>
+
+unsigned int getDataCacheSize(unsigned int level);
+std::string getCpuBrand();
+// true when performance and efficiency cores are mixed
+bool isHybridCpu();
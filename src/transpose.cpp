@@ -0,0 +1,234 @@
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include <assert.h>
+
+#include <coat/Function.h>
+#include <coat/ControlFlow.h>
+#include <coat/Vec.h>
+#include <coat/Mask.h>
+#include "dnnl_thread.hpp"
+#include "boat.h"
+#include "jit_math.h"
+
+#define ENABLE_DUMP 0
+
+using namespace dnnl::impl;
+using namespace dnnl::impl::utils;
+
+namespace boat {
+
+//
+// 4 byte units are moved, so fp32, bf16 pairs and int8 quads share the same code.
+// rows are walked in blocks of width, columns in blocks of width units, every tile is:
+//   load width rows                    --> rows after the row tail are not loaded
+//   unpcklps/unpckhps                  --> 2x2 blocks of units
+//   unpcklpd/unpckhpd                  --> 4x4 blocks inside each 128 bit lane
+//   shuff32x4 x 2                      --> exchange 128 bit lanes
+//   store width columns as dst rows    --> row tail is masked
+//
+using transpose_func_t = void (*)(int rows, uint8_t* src, uint8_t* dst);
+template <unsigned width>
+static transpose_func_t make_transpose(const TransposeStaticParam& static_param) {
+    static_assert(width == 16, "transpose network is 16x16");
+    int elem_size = static_param.elem_size;
+    int group = static_param.group;
+    if (elem_size * group != 4 || static_param.cols <= 0 || static_param.cols % group) {
+        std::cout << "transpose needs elem_size * group == 4 and cols to be a multiple of group" << std::endl;
+        return nullptr;
+    }
+    if (static_param.ld_src % 4 || static_param.ld_dst % 4) {
+        std::cout << "transpose needs ld_src and ld_dst to be multiple of 4" << std::endl;
+        return nullptr;
+    }
+    int cols = static_param.cols / group;
+    int ld_src = static_param.ld_src / 4;
+    int ld_dst = static_param.ld_dst / 4;
+    auto fn = coat::createFunction<transpose_func_t>("transpose");
+    fn.funcNode->frame().setAvx512Enabled();
+#if ENABLE_DUMP
+    fn.enableCodeDump();
+#endif
+    int col_num = cols / width;
+    int col_tail = cols % width;
+    {
+        if (col_tail) {
+            coat::Value<int> j_mask((1 << col_tail) - 1);
+            _CC.kmovq(asmjit::x86::k1, j_mask);
+        }
+        auto [j_rows, j_src_, j_dst_] = fn.getArguments("rows", "src", "dst");
+        // units are only moved around, float is used for the addressing
+        auto j_src = j_src_.cast<float>();
+        auto j_dst = j_dst_.cast<float>();
+        coat::Mask j_row_mask("row_tail");
+        std::vector<share_vec<width>> j_a, j_b;
+        for (unsigned i = 0; i < width; i++) {
+            j_a.push_back(std::make_shared<coat::Vec<float, width>>());
+            j_b.push_back(std::make_shared<coat::Vec<float, width>>());
+        }
+
+        // j_a[i] = row i of the tile --> j_a[i] = column i of the tile
+        auto transpose_tile = [&] {
+            for (unsigned i = 0; i < width / 2; i++) {
+                _CC.vunpcklps(j_b[2 * i]->reg, j_a[2 * i]->reg, j_a[2 * i + 1]->reg);
+                _CC.vunpckhps(j_b[2 * i + 1]->reg, j_a[2 * i]->reg, j_a[2 * i + 1]->reg);
+            }
+            for (unsigned i = 0; i < width / 4; i++) {
+                _CC.vunpcklpd(j_a[4 * i + 0]->reg, j_b[4 * i]->reg, j_b[4 * i + 2]->reg);
+                _CC.vunpckhpd(j_a[4 * i + 1]->reg, j_b[4 * i]->reg, j_b[4 * i + 2]->reg);
+                _CC.vunpcklpd(j_a[4 * i + 2]->reg, j_b[4 * i + 1]->reg, j_b[4 * i + 3]->reg);
+                _CC.vunpckhpd(j_a[4 * i + 3]->reg, j_b[4 * i + 1]->reg, j_b[4 * i + 3]->reg);
+            }
+            for (unsigned h = 0; h < 2; h++) {
+                for (unsigned i = 0; i < 4; i++) {
+                    _CC.vshuff32x4(j_b[8 * h + i]->reg, j_a[8 * h + i]->reg, j_a[8 * h + 4 + i]->reg, 0x88);
+                    _CC.vshuff32x4(j_b[8 * h + 4 + i]->reg, j_a[8 * h + i]->reg, j_a[8 * h + 4 + i]->reg, 0xDD);
+                }
+            }
+            for (unsigned i = 0; i < width / 2; i++) {
+                _CC.vshuff32x4(j_a[i]->reg, j_b[i]->reg, j_b[8 + i]->reg, 0x88);
+                _CC.vshuff32x4(j_a[8 + i]->reg, j_b[i]->reg, j_b[8 + i]->reg, 0xDD);
+            }
+        };
+        // one tile at j_s/j_d, j_tail is the valid row number of a tail tile
+        auto tile = [&] (coat::wrapper_type<float*>& j_s, coat::wrapper_type<float*>& j_d, bool col_masked, coat::Value<int>* j_tail) {
+            auto load = [&] (int r) {
+                if (col_masked)
+                    j_a[r]->kzload(j_s[r * ld_src], asmjit::x86::k1);
+                else
+                    j_a[r]->load(j_s[r * ld_src]);
+            };
+            if (j_tail) {
+                asmjit::Label L_End = _CC.newLabel();
+                for (unsigned r = 0; r < width; r++)
+                    *j_a[r] = 0;
+                for (int r = 0; r < static_cast<int>(width); r++) {
+                    if (r) {
+                        coat::if_then(*j_tail == r, [&] {
+                            _CC.jmp(L_End);
+                        });
+                    }
+                    load(r);
+                }
+                _CC.bind(L_End);
+            } else {
+                for (int r = 0; r < static_cast<int>(width); r++)
+                    load(r);
+            }
+            transpose_tile();
+            int store_num = col_masked ? col_tail : static_cast<int>(width);
+            for (int c = 0; c < store_num; c++) {
+                if (j_tail)
+                    j_a[c]->kstore(j_d[c * ld_dst], j_row_mask.reg);
+                else
+                    j_a[c]->store(j_d[c * ld_dst]);
+            }
+        };
+        // all column tiles of one row block
+        auto row_block = [&] (coat::Value<int>* j_tail) {
+            auto j_s = j_src;
+            auto j_d = j_dst;
+            if (col_num > 0) {
+                coat::Value<int> j_c(int(0), "c");
+                coat::for_loop(j_c < col_num,
+                    [&] {
+                        j_c += 1;
+                        j_s += static_cast<int>(width);
+                        j_d += static_cast<int>(width) * ld_dst;
+                    },
+                    [&] {
+                        tile(j_s, j_d, false, j_tail);
+                    });
+            }
+            if (col_tail)
+                tile(j_s, j_d, true, j_tail);
+        };
+
+        coat::Value<int> j_r(int(0), "r");
+        coat::Value<int> j_full_end("full_end");
+        j_full_end = j_rows;
+        j_full_end -= static_cast<int>(width) - 1;
+        coat::for_loop(j_r < j_full_end,
+            [&] {
+                j_r += static_cast<int>(width);
+                j_src += static_cast<int>(width) * ld_src;
+                j_dst += static_cast<int>(width);
+            },
+            [&] {
+                row_block(nullptr);
+            });
+        // row tail
+        coat::if_then(j_r < j_rows, [&] {
+            coat::Value<int> j_tail("row_tail");
+            coat::Value<int> j_bits(int(1), "bits");
+            j_tail = j_rows;
+            j_tail -= j_r;
+            j_bits <<= j_tail;
+            j_bits -= 1;
+            _CC.kmovw(j_row_mask.reg, j_bits.reg);
+            row_block(&j_tail);
+        });
+        // specify return value
+        coat::ret();
+    }
+
+    // finalize code generation and get function pointer to the generated function
+    auto foo = fn.finalize();
+    return foo;
+}
+
+struct transpose::transpose_impl {
+    transpose_func_t _func = nullptr;
+    int _nthread = 0;
+    TransposeStaticParam _static_param;
+
+    bool init(const TransposeStaticParam& static_param) {
+        _nthread = dnnl_get_max_threads();
+        _static_param = static_param;
+        _func = make_transpose<16>(static_param);
+        return _func != nullptr;
+    }
+
+    void exec(const TransposeRuntimeParam& runtime_param) {
+        assert(_func);
+        const int width = 16;
+        auto src = static_cast<uint8_t*>(runtime_param.src);
+        auto dst = static_cast<uint8_t*>(runtime_param.dst);
+        int row_blocks = (runtime_param.rows + width - 1) / width;
+        size_t bytes = static_cast<size_t>(runtime_param.rows) * _static_param.cols * _static_param.elem_size;
+        // a panel of a packing loop is small and the caller is already parallel
+        if (_nthread == 1 || row_blocks == 1 || bytes < 256 * 1024) {
+            _func(runtime_param.rows, src, dst);
+            return;
+        }
+        parallel(_nthread, [&](const int ithr, const int nthr) {
+            int start, end;
+            balance211(row_blocks, nthr, ithr, start, end);
+            if (start >= end) return;
+            int row_start = start * width;
+            int row_end = std::min(end * width, runtime_param.rows);
+            _func(row_end - row_start, src + static_cast<size_t>(row_start) * _static_param.ld_src, dst + row_start * 4);
+        });
+    }
+
+    ~transpose_impl() {
+        if (_func)
+            coat::getJitRuntimeEnv().release_func(_func);
+    }
+};
+
+transpose::transpose() :
+    _impl(std::make_shared<transpose_impl>()) {
+}
+
+bool transpose::init(const TransposeStaticParam& static_param) {
+    return _impl->init(static_param);
+}
+
+void transpose::operator()(const TransposeRuntimeParam& runtime_param) {
+    _impl->exec(runtime_param);
+}
+
+};
@@ -12,6 +12,13 @@ using namespace boat;
 //     --stag=ab --wtag=ab --dtag=ab  --attr-scratchpad=user mb15ic512oc37
 DEFINE_int32(fix_times_per_prb, 1, "running times");
 DEFINE_bool(matmul, true, "inner product testing");
+DEFINE_double(a_zero_ratio, 0, "ratio of zeros in src, zeros are spread evenly");
+DEFINE_bool(skip_zero_a, false, "skip zeros in src");
+DEFINE_int32(prefetch_a, 0, "prefetch distance of src in k iterations, 0 default, < 0 off");
+DEFINE_int32(prefetch_b, 0, "prefetch distance of weight in k iterations, 0 default, < 0 off");
+DEFINE_int32(prefetch_c, 0, "prefetch dst before the k loop, 0 default, < 0 off");
+DEFINE_bool(all_threads, false, "use every thread instead of the count picked by the cost model");
+DEFINE_int32(chunk, -1, "dynamic scheduling with this many blocks per grab (0 means 1), < 0 the default schedule");
 
 using Ms = std::chrono::duration<double, std::ratio<1, 1000>>;
 
@@ -26,6 +33,15 @@ void test_ip(const char* param) {
         dnnl_f32, dnnl_f32, dnnl_f32,
         N, K, K * 4, N * 4, N * 4
     };
+    gemmParam.skip_zero_a = FLAGS_skip_zero_a;
+    gemmParam.prefetch.a_dist = FLAGS_prefetch_a;
+    gemmParam.prefetch.b_dist = FLAGS_prefetch_b;
+    gemmParam.prefetch.c = FLAGS_prefetch_c;
+    gemmParam.schedule.all_threads = FLAGS_all_threads;
+    if (FLAGS_chunk >= 0) {
+        gemmParam.schedule.kind = GemmSchedule::Dynamic;
+        gemmParam.schedule.chunk = FLAGS_chunk;
+    }
     if (!gemm.init(gemmParam)) {
         std::cout << "init ip failed with:" << param << "\n";
         return;
@@ -33,6 +49,12 @@ void test_ip(const char* param) {
     std::vector<float> a(M * K, 2), b(K * N, 1), c(M * N);
     std::iota(a.begin(), a.end(), 1.0f);
     std::iota(b.begin(), b.end(), 2.0f);
+    if (FLAGS_a_zero_ratio > 0) {
+        for (size_t i = 0; i < a.size(); i++) {
+            if ((i * 7919 % 1000) < FLAGS_a_zero_ratio * 1000)
+                a[i] = 0;
+        }
+    }
     GemmDynMRuntimeParam rtParam = {
         M, a.data(), b.data(), c.data()
     };
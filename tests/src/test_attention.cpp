@@ -0,0 +1,153 @@
+#include <cstdio>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include <cmath>
+#include <thread>
+#include "gtest/gtest.h"
+#include "boat.h"
+
+using namespace std;
+using namespace boat;
+using ::testing::TestWithParam;
+using ::testing::Values;
+using ::testing::ValuesIn;
+
+using AttentionTestParamSet = std::tuple<
+        AttnMaskType,                                // mask
+        int,                                         // head_size
+        int,                                         // q_len
+        int                                          // kv_len
+        >;
+
+class AttentionTest : public TestWithParam<AttentionTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<AttentionTestParamSet>& obj) {
+        AttnMaskType mask;
+        int head_size, q_len, kv_len;
+        std::tie(mask, head_size, q_len, kv_len) = obj.param;
+
+        std::ostringstream result;
+        result << "mask_" << static_cast<int>(mask) << "_H_" << head_size << "_Q_" << q_len << "_KV_" << kv_len;
+        return result.str();
+    }
+};
+
+static void attention_ref(const float* q, const float* k, const float* v, float* out, const float* mask,
+    AttnMaskType mask_type, int q_len, int kv_len, int head_size, float scale) {
+    std::vector<float> s(kv_len);
+    for (int i = 0; i < q_len; i++) {
+        float max = -std::numeric_limits<float>::infinity();
+        for (int j = 0; j < kv_len; j++) {
+            float dot = 0;
+            for (int d = 0; d < head_size; d++)
+                dot += q[i * head_size + d] * k[j * head_size + d];
+            s[j] = dot * scale;
+            if (mask_type == AttnMaskType::PerElement)
+                s[j] += mask[i * kv_len + j];
+            if (mask_type == AttnMaskType::Causal && j > i + kv_len - q_len)
+                s[j] = -std::numeric_limits<float>::infinity();
+            max = std::max(max, s[j]);
+        }
+        float sum = 0;
+        for (int j = 0; j < kv_len; j++) {
+            s[j] = std::exp(s[j] - max);
+            sum += s[j];
+        }
+        for (int d = 0; d < head_size; d++) {
+            float acc = 0;
+            for (int j = 0; j < kv_len; j++)
+                acc += s[j] * v[j * head_size + d];
+            out[i * head_size + d] = acc / sum;
+        }
+    }
+}
+
+TEST_P(AttentionTest, Func) {
+    auto [mask_type, head_size, q_len, kv_len] = GetParam();
+    const int batch = 3;
+    AttentionStaticParam param = {
+        dnnl_f32, head_size,
+        head_size * 4, head_size * 4, head_size * 4, head_size * 4,
+        0, mask_type, kv_len * 4
+    };
+    attention attn;
+    ASSERT_TRUE(attn.init(param));
+
+    size_t q_size = q_len * head_size, kv_size = kv_len * head_size;
+    std::vector<float> q(batch * q_size), k(batch * kv_size), v(batch * kv_size), out(batch * q_size), out_ref(batch * q_size);
+    std::vector<float> mask(q_len * kv_len);
+    for (size_t i = 0; i < q.size(); i++) q[i] = static_cast<float>((i * 7) % 11) / 8.0f - 0.6f;
+    for (size_t i = 0; i < k.size(); i++) k[i] = static_cast<float>((i * 5) % 13) / 8.0f - 0.7f;
+    for (size_t i = 0; i < v.size(); i++) v[i] = static_cast<float>((i * 3) % 17) / 4.0f - 2.0f;
+    for (size_t i = 0; i < mask.size(); i++) mask[i] = (i % 5 == 3) ? -10000.0f : static_cast<float>(i % 3) / 4.0f;
+    AttentionRuntimeParam rtParam = {
+        batch, q_len, kv_len,
+        q.data(), k.data(), v.data(), out.data(), mask.data(),
+        q_size * 4, kv_size * 4, kv_size * 4, q_size * 4
+    };
+    attn(rtParam);
+
+    float scale = 1.0f / std::sqrt(static_cast<float>(head_size));
+    for (int b = 0; b < batch; b++) {
+        attention_ref(&q[b * q_size], &k[b * kv_size], &v[b * kv_size], &out_ref[b * q_size], mask.data(),
+            mask_type, q_len, kv_len, head_size, scale);
+    }
+    for (size_t i = 0; i < out.size(); i++) {
+        ASSERT_NEAR(out[i], out_ref[i], 0.0001f * std::abs(out_ref[i]) + 0.0001f) << "first error at " << i;
+    }
+}
+
+const auto attentionCase = ::testing::Combine(
+    Values(AttnMaskType::None, AttnMaskType::Causal, AttnMaskType::PerElement),
+    Values(16, 40, 64),
+    Values(1, 13, 100),
+    Values(100, 257)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_Attention, AttentionTest, attentionCase, AttentionTest::getTestCaseName);
+
+// callers with different kv_len share one attention, each packs k into its own buffer
+TEST(AttentionConcurrentTest, Func) {
+    const int head_size = 40, q_len = 13, caller_num = 4;
+    AttentionStaticParam param = {
+        dnnl_f32, head_size,
+        head_size * 4, head_size * 4, head_size * 4, head_size * 4,
+        0, AttnMaskType::Causal
+    };
+    attention attn;
+    ASSERT_TRUE(attn.init(param));
+
+    float scale = 1.0f / std::sqrt(static_cast<float>(head_size));
+    std::vector<int> errors(caller_num);
+    std::vector<std::thread> callers;
+    for (int t = 0; t < caller_num; t++) {
+        callers.emplace_back([&, t] {
+            int kv_len = 50 + t * 70;
+            size_t q_size = q_len * head_size, kv_size = kv_len * head_size;
+            std::vector<float> q(q_size), k(kv_size), v(kv_size), out(q_size), out_ref(q_size);
+            for (size_t i = 0; i < q.size(); i++) q[i] = static_cast<float>((i * 7 + t) % 11) / 8.0f - 0.6f;
+            for (size_t i = 0; i < k.size(); i++) k[i] = static_cast<float>((i * 5 + t) % 13) / 8.0f - 0.7f;
+            for (size_t i = 0; i < v.size(); i++) v[i] = static_cast<float>((i * 3) % 17) / 4.0f - 2.0f;
+            attention_ref(q.data(), k.data(), v.data(), out_ref.data(), nullptr, AttnMaskType::Causal,
+                q_len, kv_len, head_size, scale);
+            for (int round = 0; round < 20; round++) {
+                AttentionRuntimeParam rtParam = {
+                    1, q_len, kv_len,
+                    q.data(), k.data(), v.data(), out.data(), nullptr,
+                    q_size * 4, kv_size * 4, kv_size * 4, q_size * 4
+                };
+                attn(rtParam);
+                for (size_t i = 0; i < out.size(); i++) {
+                    if (std::abs(out[i] - out_ref[i]) > 0.0001f * std::abs(out_ref[i]) + 0.0001f)
+                        errors[t]++;
+                }
+            }
+        });
+    }
+    for (auto& caller : callers)
+        caller.join();
+    for (int t = 0; t < caller_num; t++)
+        ASSERT_EQ(errors[t], 0) << "caller " << t;
+}
@@ -0,0 +1,174 @@
+#include <cstdio>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include <cmath>
+#include "gtest/gtest.h"
+#include "boat.h"
+
+using namespace std;
+using namespace boat;
+using ::testing::TestWithParam;
+using ::testing::Values;
+using ::testing::ValuesIn;
+
+using ConvTestParamSet = std::tuple<
+        int,                                         // IC
+        int,                                         // OC
+        int,                                         // IH == IW
+        int,                                         // KH == KW
+        int,                                         // stride
+        int                                          // pad
+        >;
+
+class ConvTest : public TestWithParam<ConvTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<ConvTestParamSet>& obj) {
+        int IC, OC, I, K, stride, pad;
+        std::tie(IC, OC, I, K, stride, pad) = obj.param;
+
+        std::ostringstream result;
+        result << "IC_" << IC << "_OC_" << OC << "_I_" << I << "_K_" << K << "_S_" << stride << "_P_" << pad;
+        return result.str();
+    }
+};
+
+static void conv_ref(const float* src, const float* wei, float* dst, const float* bias, const ConvStaticParam& p, int mb) {
+    for (int n = 0; n < mb; n++)
+    for (int oh = 0; oh < p.OH; oh++)
+    for (int ow = 0; ow < p.OW; ow++)
+    for (int oc = 0; oc < p.OC; oc++) {
+        float sum = 0;
+        for (int kh = 0; kh < p.KH; kh++) {
+            int ih = oh * p.stride_h - p.pad_t + kh;
+            if (ih < 0 || ih >= p.IH) continue;
+            for (int kw = 0; kw < p.KW; kw++) {
+                int iw = ow * p.stride_w - p.pad_l + kw;
+                if (iw < 0 || iw >= p.IW) continue;
+                for (int ic = 0; ic < p.IC; ic++)
+                    sum += src[((n * p.IH + ih) * p.IW + iw) * p.IC + ic] * wei[((kh * p.KW + kw) * p.IC + ic) * p.OC + oc];
+            }
+        }
+        dst[((n * p.OH + oh) * p.OW + ow) * p.OC + oc] = std::abs(sum) + bias[oc];
+    }
+}
+
+TEST_P(ConvTest, Func) {
+    auto [IC, OC, I, K, stride, pad] = GetParam();
+    const int mb = 2;
+    int O = (I + 2 * pad - K) / stride + 1;
+    ConvStaticParam param = {
+        dnnl_f32, dnnl_f32, dnnl_f32,
+        IC, OC, I, I, O, O, K, K, stride, stride, pad, pad
+    };
+    PostOpStaticParams& post_ops = param.post_static_params;
+    post_ops.num = 2;
+    post_ops.ops[0].alg_type = AlgType::Abs;
+    post_ops.ops[1].alg_type = AlgType::Add;
+    post_ops.ops[1].binary_param.layout = BinaryDataLayout::PerChannel;
+    conv cv;
+    ASSERT_TRUE(cv.init(param));
+
+    std::vector<float> src(mb * I * I * IC), wei(K * K * IC * OC), dst(mb * O * O * OC), dst_ref(mb * O * O * OC), bias(OC);
+    for (size_t i = 0; i < src.size(); i++) src[i] = static_cast<float>((i * 7) % 11) / 16.0f - 0.3f;
+    for (size_t i = 0; i < wei.size(); i++) wei[i] = static_cast<float>((i * 5) % 13) / 16.0f - 0.4f;
+    for (int i = 0; i < OC; i++) bias[i] = static_cast<float>(i % 9) - 4.0f;
+    ConvRuntimeParam rtParam = {
+        mb, src.data(), wei.data(), dst.data()
+    };
+    rtParam.post_runtime_params.params[1].right_addr = bias.data();
+    cv(rtParam);
+
+    conv_ref(src.data(), wei.data(), dst_ref.data(), bias.data(), param, mb);
+    for (size_t i = 0; i < dst.size(); i++) {
+        ASSERT_NEAR(dst[i], dst_ref[i], 0.00001f * std::abs(dst_ref[i]) + 0.0001f) << "first error at " << i;
+    }
+}
+
+const auto convCase = Values(
+    std::make_tuple(3, 32, 15, 3, 2, 1),
+    std::make_tuple(40, 100, 14, 3, 1, 1),
+    std::make_tuple(64, 48, 7, 1, 1, 0),
+    std::make_tuple(32, 40, 9, 1, 2, 0),
+    std::make_tuple(16, 24, 10, 5, 1, 2),
+    std::make_tuple(17, 200, 6, 3, 1, 4)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_Conv, ConvTest, convCase, ConvTest::getTestCaseName);
+
+using DwConvTestParamSet = std::tuple<
+        int,                                         // C
+        int,                                         // IH == IW
+        int,                                         // KH == KW
+        int,                                         // stride
+        int                                          // pad
+        >;
+
+class DwConvTest : public TestWithParam<DwConvTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<DwConvTestParamSet>& obj) {
+        int C, I, K, stride, pad;
+        std::tie(C, I, K, stride, pad) = obj.param;
+
+        std::ostringstream result;
+        result << "C_" << C << "_I_" << I << "_K_" << K << "_S_" << stride << "_P_" << pad;
+        return result.str();
+    }
+};
+
+TEST_P(DwConvTest, Func) {
+    auto [C, I, K, stride, pad] = GetParam();
+    const int mb = 2;
+    int O = (I + 2 * pad - K) / stride + 1;
+    DwConvStaticParam param = {
+        dnnl_f32, dnnl_f32, dnnl_f32,
+        C, I, I, O, O, K, K, stride, stride, pad, pad
+    };
+    PostOpStaticParams& post_ops = param.post_static_params;
+    post_ops.num = 2;
+    post_ops.ops[0].alg_type = AlgType::Abs;
+    post_ops.ops[1].alg_type = AlgType::Add;
+    post_ops.ops[1].binary_param.layout = BinaryDataLayout::PerChannel;
+    dw_conv cv;
+    ASSERT_TRUE(cv.init(param));
+
+    std::vector<float> src(mb * I * I * C), wei(K * K * C), dst(mb * O * O * C), dst_ref(mb * O * O * C), bias(C);
+    for (size_t i = 0; i < src.size(); i++) src[i] = static_cast<float>((i * 7) % 11) / 16.0f - 0.3f;
+    for (size_t i = 0; i < wei.size(); i++) wei[i] = static_cast<float>((i * 5) % 13) / 16.0f - 0.4f;
+    for (int i = 0; i < C; i++) bias[i] = static_cast<float>(i % 9) - 4.0f;
+    DwConvRuntimeParam rtParam = {
+        mb, src.data(), wei.data(), dst.data()
+    };
+    rtParam.post_runtime_params.params[1].right_addr = bias.data();
+    cv(rtParam);
+
+    for (int n = 0; n < mb; n++)
+    for (int oh = 0; oh < O; oh++)
+    for (int ow = 0; ow < O; ow++)
+    for (int c = 0; c < C; c++) {
+        float sum = 0;
+        for (int kh = 0; kh < K; kh++) {
+            int ih = oh * stride - pad + kh;
+            if (ih < 0 || ih >= I) continue;
+            for (int kw = 0; kw < K; kw++) {
+                int iw = ow * stride - pad + kw;
+                if (iw < 0 || iw >= I) continue;
+                sum += src[((n * I + ih) * I + iw) * C + c] * wei[(kh * K + kw) * C + c];
+            }
+        }
+        dst_ref[((n * O + oh) * O + ow) * C + c] = std::abs(sum) + bias[c];
+    }
+    for (size_t i = 0; i < dst.size(); i++) {
+        ASSERT_NEAR(dst[i], dst_ref[i], 0.00001f * std::abs(dst_ref[i]) + 0.0001f) << "first error at " << i;
+    }
+}
+
+const auto dwConvCase = Values(
+    std::make_tuple(32, 15, 3, 1, 1),
+    std::make_tuple(40, 14, 3, 2, 1),
+    std::make_tuple(7, 9, 5, 1, 2),
+    std::make_tuple(144, 10, 3, 1, 1),
+    std::make_tuple(200, 7, 7, 2, 3)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_DwConv, DwConvTest, dwConvCase, DwConvTest::getTestCaseName);
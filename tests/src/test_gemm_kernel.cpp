@@ -8,6 +8,7 @@
 #include "gtest/gtest.h"
 #include "boat.h"
 #include "test_gemm_common.h"
+#include "gemm_kernel.h"
 
 using namespace std;
 using namespace boat;
@@ -148,3 +149,124 @@ const std::vector<GemmKernelTestParamSet> kernelCase = {
     {256 + 9, 47, 449},
 };
 INSTANTIATE_TEST_SUITE_P(smoke_GemmKernel, GemmKernelTest, ValuesIn(kernelCase), GemmKernelTest::getTestCaseName);
+
+class GemmKernelStreamTest : public TestWithParam<GemmKernelTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<GemmKernelTestParamSet>& obj) {
+        return GemmKernelTest::getTestCaseName(obj);
+    }
+};
+
+TEST_P(GemmKernelStreamTest, Func) {
+    auto [M, N, K] = GetParam();
+    // rows of C start on a cache line
+    int ldc = (N + 15) / 16 * 16;
+    GemmDynMStaticParam param = {
+        dnnl_f32, dnnl_f32, dnnl_f32,
+        N, K, K * 4, N * 4, ldc * 4
+    };
+    param.c_stream = true;
+    gemm_kernel<cpu_isa_t::avx512_core> gemm;
+    ASSERT_TRUE(gemm.init(param));
+
+    std::vector<float> a(M * K), b(K * N), c_buf(M * ldc + 16), c_ref(M * ldc);
+    for (int i = 0; i < M * K; i++) a[i] = static_cast<float>((i * 7) % 11) / 16.0f - 0.3f;
+    for (int i = 0; i < K * N; i++) b[i] = static_cast<float>((i * 5) % 13) / 16.0f - 0.4f;
+    auto c = c_buf.data() + (64 - reinterpret_cast<uintptr_t>(c_buf.data()) % 64) % 64 / sizeof(float);
+    GemmDynMRuntimeParam rtParam = {
+        M, a.data(), b.data(), c
+    };
+    gemm(rtParam);
+
+    matmul_ref(a.data(), b.data(), c_ref.data(), M, N, K, K, N, ldc);
+    for (int m = 0; m < M; m++) {
+        for (int n = 0; n < N; n++) {
+            ASSERT_NEAR(c[m * ldc + n], c_ref[m * ldc + n], 0.00001f * std::abs(c_ref[m * ldc + n]) + 0.00001f)
+                << "first error at " << m << ", " << n;
+        }
+    }
+}
+
+const std::vector<GemmKernelTestParamSet> streamCase = {
+    {256, 48, 64},
+    {265, 47, 37},
+    {7, 64, 100},
+};
+INSTANTIATE_TEST_SUITE_P(smoke_GemmKernelStream, GemmKernelStreamTest, ValuesIn(streamCase), GemmKernelStreamTest::getTestCaseName);
+
+class GemmKernelAlignedTest : public TestWithParam<GemmKernelTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<GemmKernelTestParamSet>& obj) {
+        return GemmKernelTest::getTestCaseName(obj);
+    }
+};
+
+TEST_P(GemmKernelAlignedTest, Func) {
+    auto [M, N, K] = GetParam();
+    // rows of B and C start on a cache line
+    int ld = (N + 15) / 16 * 16;
+    GemmDynMStaticParam param = {
+        dnnl_f32, dnnl_f32, dnnl_f32,
+        N, K, K * 4, ld * 4, ld * 4
+    };
+    param.aligned = true;
+    gemm_kernel<cpu_isa_t::avx512_core> gemm;
+    ASSERT_TRUE(gemm.init(param));
+
+    std::vector<float> a(M * K), b_buf(K * ld + 16), c_buf(M * ld + 16), c_ref(M * ld);
+    auto align = [] (float* p) {
+        return p + (64 - reinterpret_cast<uintptr_t>(p) % 64) % 64 / sizeof(float);
+    };
+    auto b = align(b_buf.data());
+    auto c = align(c_buf.data());
+    for (int i = 0; i < M * K; i++) a[i] = static_cast<float>((i * 7) % 11) / 16.0f - 0.3f;
+    for (int i = 0; i < K * ld; i++) b[i] = static_cast<float>((i * 5) % 13) / 16.0f - 0.4f;
+    GemmDynMRuntimeParam rtParam = {
+        M, a.data(), b, c
+    };
+    gemm(rtParam);
+
+    matmul_ref(a.data(), b, c_ref.data(), M, N, K, K, ld, ld);
+    for (int m = 0; m < M; m++) {
+        for (int n = 0; n < N; n++) {
+            ASSERT_NEAR(c[m * ld + n], c_ref[m * ld + n], 0.00001f * std::abs(c_ref[m * ld + n]) + 0.00001f)
+                << "first error at " << m << ", " << n;
+        }
+    }
+}
+
+const std::vector<GemmKernelTestParamSet> alignedCase = {
+    {256, 48, 64},
+    {33, 47, 37},
+    {7, 64, 100},
+};
+INSTANTIATE_TEST_SUITE_P(smoke_GemmKernelAligned, GemmKernelAlignedTest, ValuesIn(alignedCase), GemmKernelAlignedTest::getTestCaseName);
+
+// the prefetch defaults follow the shape: nothing for a block that stays in L1, everything once the rows of
+// A, the B panel and the C lines of an m group outgrow it
+TEST(GemmKernelPrefetchTest, Default) {
+    GemmDynMStaticParam small = {
+        dnnl_f32, dnnl_f32, dnnl_f32,
+        48, 64, 64 * 4, 48 * 4, 48 * 4
+    };
+    auto prefetch = get_prefetch(small);
+    EXPECT_EQ(prefetch.a_dist, 0);
+    EXPECT_EQ(prefetch.b_dist, 0);
+    EXPECT_EQ(prefetch.c, 0);
+    small.prefetch.c = 1;
+    EXPECT_EQ(get_prefetch(small).c, 1);
+
+    GemmDynMStaticParam large = {
+        dnnl_f32, dnnl_f32, dnnl_f32,
+        64, 4096, 4096 * 4, 4096 * 4, 4096 * 4
+    };
+    prefetch = get_prefetch(large);
+    EXPECT_GT(prefetch.a_dist, 0);
+    EXPECT_GT(prefetch.b_dist, 0);
+    EXPECT_EQ(prefetch.c, 1);
+    large.prefetch.c = -1;
+    EXPECT_EQ(get_prefetch(large).c, 0);
+    large.prefetch.c = 1;
+    large.c_stream = true;
+    EXPECT_EQ(get_prefetch(large).c, 0);
+}
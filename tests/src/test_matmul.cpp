@@ -5,9 +5,17 @@
 #include <memory>
 #include <chrono>
 #include <iostream>
+#include <cmath>
+#include <thread>
+#ifdef __linux__
+#include <sched.h>
+#endif
 #include "gtest/gtest.h"
 #include "boat.h"
+#include "oneapi/dnnl/dnnl_threadpool_iface.hpp"
 #include "test_gemm_common.h"
+#include "gemm_kernel.h"
+#include "matmul.h"
 
 using namespace std;
 using namespace boat;
@@ -151,3 +159,1028 @@ const auto kernelCase = ::testing::Combine(
     ValuesIn(Ks)
 );
 INSTANTIATE_TEST_SUITE_P(smoke_GemmDriver, GemmDriverTest, kernelCase, GemmDriverTest::getTestCaseName);
+
+// two experts scatter their weighted outputs back to the token rows
+TEST(GemmDriverScatterTest, MoECombine) {
+    const int tokens = 300, N = 130, K = 257, expert_M[2] = {173, 211};
+    std::vector<float> c(tokens * N, 0), c_ref(tokens * N, 0);
+    std::vector<int> order(tokens);
+    std::iota(order.begin(), order.end(), 0);
+    for (int e = 0; e < 2; e++) {
+        int M = expert_M[e];
+        GemmDynMStaticParam param = {
+            dnnl_f32, dnnl_f32, dnnl_f32,
+            N, K, K * 4, N * 4, N * 4
+        };
+        param.c_store_mode = CStoreMode::ScatterAccumulate;
+        matmul gemm;
+        ASSERT_TRUE(gemm.init(param));
+
+        std::vector<float> a(M * K), b(K * N), scale(M), tmp(M * N);
+        std::vector<int> index(M);
+        for (int i = 0; i < M * K; i++) a[i] = static_cast<float>((i + e) % 7) - 3.0f;
+        for (int i = 0; i < K * N; i++) b[i] = static_cast<float>((i * (e + 1)) % 5) - 2.0f;
+        // every token shows up at most once per expert
+        std::rotate(order.begin(), order.begin() + 37, order.end());
+        for (int m = 0; m < M; m++) {
+            index[m] = order[m];
+            scale[m] = 0.25f * ((m % 3) + 1);
+        }
+        GemmDynMRuntimeParam rtParam = {
+            M, a.data(), b.data(), c.data()
+        };
+        rtParam.post_runtime_params.c_row_index = index.data();
+        rtParam.post_runtime_params.c_row_scale = scale.data();
+        gemm(rtParam);
+
+        matmul_ref(a.data(), b.data(), tmp.data(), M, N, K, K, N, N);
+        for (int m = 0; m < M; m++)
+            for (int n = 0; n < N; n++)
+                c_ref[index[m] * N + n] += tmp[m * N + n] * scale[m];
+    }
+    for (int i = 0; i < tokens * N; i++) {
+        ASSERT_NEAR(c[i], c_ref[i], 0.00001f * std::abs(c_ref[i]) + 0.0001f) << "first error at " << i;
+    }
+}
+
+using RowReduceTestParamSet = std::tuple<
+        RowReduceAlg,                                // alg
+        int,                                         // N
+        bool                                         // skip C
+        >;
+
+class GemmDriverRowReduceTest : public TestWithParam<RowReduceTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<RowReduceTestParamSet>& obj) {
+        RowReduceAlg alg;
+        int N;
+        bool skip_c;
+        std::tie(alg, N, skip_c) = obj.param;
+
+        std::ostringstream result;
+        result << "alg_" << static_cast<int>(alg) << "_N_" << N << "_skipC_" << skip_c;
+        return result.str();
+    }
+};
+
+TEST_P(GemmDriverRowReduceTest, Normal) {
+    auto [alg, N, skip_c] = GetParam();
+    const int M = 131, K = 67, k = alg == RowReduceAlg::TopK ? 5 : 1;
+    GemmDynMStaticParam param = {
+        dnnl_f32, dnnl_f32, dnnl_f32,
+        N, K, K * 4, N * 4, N * 4
+    };
+    param.row_reduce.alg = alg;
+    param.row_reduce.k = k;
+    param.row_reduce.skip_c = skip_c;
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+
+    std::vector<float> a(M * K), b(K * N), c(M * N, -1.0f), c_ref(M * N);
+    for (int i = 0; i < M * K; i++) a[i] = static_cast<float>((i * 7) % 11) / 8.0f - 0.5f;
+    for (int i = 0; i < K * N; i++) b[i] = static_cast<float>((i * 5) % 13) / 8.0f - 0.75f;
+    std::vector<float> val(M * k);
+    std::vector<int> idx(M * k);
+    GemmDynMRuntimeParam rtParam = {
+        M, a.data(), b.data(), c.data()
+    };
+    rtParam.post_runtime_params.row_reduce_val = val.data();
+    rtParam.post_runtime_params.row_reduce_idx = idx.data();
+    gemm(rtParam);
+
+    matmul_ref(a.data(), b.data(), c_ref.data(), M, N, K, K, N, N);
+    for (int m = 0; m < M; m++) {
+        const float* row = &c_ref[m * N];
+        std::vector<int> order(N);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&] (int x, int y) { return row[x] > row[y]; });
+        switch (alg) {
+            case RowReduceAlg::Sum:
+                EXPECT_NEAR(val[m], std::accumulate(row, row + N, 0.0f), 0.001f) << "row " << m;
+                break;
+            case RowReduceAlg::Max:
+                EXPECT_EQ(val[m], row[order[0]]) << "row " << m;
+                break;
+            case RowReduceAlg::ArgMax:
+            case RowReduceAlg::TopK:
+                for (int r = 0; r < k; r++) {
+                    EXPECT_EQ(val[m * k + r], row[order[r]]) << "row " << m;
+                    EXPECT_EQ(idx[m * k + r], order[r]) << "row " << m;
+                }
+                break;
+            case RowReduceAlg::LogSumExp: {
+                float max = row[order[0]], sum = 0;
+                for (int n = 0; n < N; n++)
+                    sum += std::exp(row[n] - max);
+                EXPECT_NEAR(val[m], max + std::log(sum), 0.0001f * std::abs(max + std::log(sum)) + 0.0001f) << "row " << m;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    if (skip_c) {
+        EXPECT_TRUE(std::all_of(c.begin(), c.end(), [] (float x) { return x == -1.0f; }));
+    } else {
+        for (int i = 0; i < M * N; i++)
+            ASSERT_NEAR(c[i], c_ref[i], 0.0001f) << "first error at " << i;
+    }
+}
+
+const auto rowReduceCase = ::testing::Combine(
+    Values(RowReduceAlg::Sum, RowReduceAlg::Max, RowReduceAlg::ArgMax, RowReduceAlg::TopK, RowReduceAlg::LogSumExp),
+    Values(40, 64, 300),
+    Values(false, true)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_GemmDriverRowReduce, GemmDriverRowReduceTest, rowReduceCase, GemmDriverRowReduceTest::getTestCaseName);
+
+using RowNormTestParamSet = std::tuple<
+        RowNormAlg,                                  // alg
+        int                                          // N
+        >;
+
+class GemmDriverRowNormTest : public TestWithParam<RowNormTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<RowNormTestParamSet>& obj) {
+        RowNormAlg alg;
+        int N;
+        std::tie(alg, N) = obj.param;
+
+        std::ostringstream result;
+        result << "alg_" << static_cast<int>(alg) << "_N_" << N;
+        return result.str();
+    }
+};
+
+TEST_P(GemmDriverRowNormTest, Softmax) {
+    auto [alg, N] = GetParam();
+    const int M = 77, K = 93;
+    GemmDynMStaticParam param = {
+        dnnl_f32, dnnl_f32, dnnl_f32,
+        N, K, K * 4, N * 4, N * 4
+    };
+    param.row_norm.alg = alg;
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+
+    std::vector<float> a(M * K), b(K * N), c(M * N), c_ref(M * N);
+    for (int i = 0; i < M * K; i++) a[i] = static_cast<float>((i * 7) % 11) / 16.0f - 0.3f;
+    for (int i = 0; i < K * N; i++) b[i] = static_cast<float>((i * 5) % 13) / 16.0f - 0.4f;
+    GemmDynMRuntimeParam rtParam = {
+        M, a.data(), b.data(), c.data()
+    };
+    gemm(rtParam);
+
+    matmul_ref(a.data(), b.data(), c_ref.data(), M, N, K, K, N, N);
+    for (int m = 0; m < M; m++) {
+        float* row = &c_ref[m * N];
+        float max = *std::max_element(row, row + N), sum = 0;
+        for (int n = 0; n < N; n++)
+            sum += std::exp(row[n] - max);
+        for (int n = 0; n < N; n++)
+            row[n] = alg == RowNormAlg::Softmax ? std::exp(row[n] - max) / sum : row[n] - max - std::log(sum);
+    }
+    for (int i = 0; i < M * N; i++) {
+        ASSERT_NEAR(c[i], c_ref[i], 0.00001f * std::abs(c_ref[i]) + 0.00001f) << "first error at " << i;
+    }
+}
+
+const auto rowNormCase = ::testing::Combine(
+    Values(RowNormAlg::Softmax, RowNormAlg::LogSoftmax),
+    Values(13, 64, 200)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_GemmDriverRowNorm, GemmDriverRowNormTest, rowNormCase, GemmDriverRowNormTest::getTestCaseName);
+
+class GemmDriverLayerNormTest : public TestWithParam<RowNormTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<RowNormTestParamSet>& obj) {
+        return GemmDriverRowNormTest::getTestCaseName(obj);
+    }
+};
+
+TEST_P(GemmDriverLayerNormTest, Residual) {
+    auto [alg, N] = GetParam();
+    const int M = 77, K = 93;
+    GemmDynMStaticParam param = {
+        dnnl_f32, dnnl_f32, dnnl_f32,
+        N, K, K * 4, N * 4, N * 4
+    };
+    PostOpStaticParams& post_ops = param.post_static_params;
+    post_ops.num = 1;
+    post_ops.ops[0].alg_type = AlgType::Add;
+    post_ops.ops[0].binary_param.layout = BinaryDataLayout::PerElement;
+    param.row_norm.alg = alg;
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+
+    std::vector<float> a(M * K), b(K * N), c(M * N), c_ref(M * N), residual(M * N), gamma(N), beta(N);
+    for (int i = 0; i < M * K; i++) a[i] = static_cast<float>((i * 7) % 11) / 16.0f - 0.3f;
+    for (int i = 0; i < K * N; i++) b[i] = static_cast<float>((i * 5) % 13) / 16.0f - 0.4f;
+    for (int i = 0; i < M * N; i++) residual[i] = static_cast<float>((i * 3) % 17) / 8.0f - 1.0f;
+    for (int i = 0; i < N; i++) {
+        gamma[i] = static_cast<float>(i % 5) / 4.0f + 0.5f;
+        beta[i] = static_cast<float>(i % 7) / 8.0f - 0.25f;
+    }
+    GemmDynMRuntimeParam rtParam = {
+        M, a.data(), b.data(), c.data()
+    };
+    PostOpRuntimeParams& ops = rtParam.post_runtime_params;
+    ops.params[0].right_addr = residual.data();
+    ops.norm_gamma = gamma.data();
+    ops.norm_beta = beta.data();
+    gemm(rtParam);
+
+    matmul_ref(a.data(), b.data(), c_ref.data(), M, N, K, K, N, N);
+    for (int m = 0; m < M; m++) {
+        float* row = &c_ref[m * N];
+        double mean = 0, var = 0;
+        for (int n = 0; n < N; n++) {
+            row[n] += residual[m * N + n];
+            mean += row[n];
+        }
+        mean /= N;
+        for (int n = 0; n < N; n++)
+            var += alg == RowNormAlg::LayerNorm ? (row[n] - mean) * (row[n] - mean) : row[n] * row[n];
+        var /= N;
+        float inv_std = static_cast<float>(1.0 / std::sqrt(var + param.row_norm.eps));
+        for (int n = 0; n < N; n++) {
+            if (alg == RowNormAlg::LayerNorm)
+                row[n] = (row[n] - static_cast<float>(mean)) * inv_std * gamma[n] + beta[n];
+            else
+                row[n] = row[n] * inv_std * gamma[n];
+        }
+    }
+    for (int i = 0; i < M * N; i++) {
+        ASSERT_NEAR(c[i], c_ref[i], 0.0001f * std::abs(c_ref[i]) + 0.0001f) << "first error at " << i;
+    }
+}
+
+const auto layerNormCase = ::testing::Combine(
+    Values(RowNormAlg::LayerNorm, RowNormAlg::RMSNorm),
+    Values(13, 64, 200)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_GemmDriverLayerNorm, GemmDriverLayerNormTest, layerNormCase, GemmDriverLayerNormTest::getTestCaseName);
+
+using SparseBTestParamSet = std::tuple<
+        bool,                                        // pack b at init
+        int,                                         // N
+        int                                          // K
+        >;
+
+class GemmDriverSparseBTest : public TestWithParam<SparseBTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<SparseBTestParamSet>& obj) {
+        bool pack;
+        int N, K;
+        std::tie(pack, N, K) = obj.param;
+
+        std::ostringstream result;
+        result << "pack_" << pack << "_N_" << N << "_K_" << K;
+        return result.str();
+    }
+};
+
+TEST_P(GemmDriverSparseBTest, Func) {
+    auto [pack, N, K] = GetParam();
+    const int M = 77;
+    int k_blocks = (K + 15) / 16, n_blocks = (N + 15) / 16;
+    std::vector<uint8_t> block_mask(k_blocks * n_blocks);
+    for (int i = 0; i < k_blocks * n_blocks; i++)
+        block_mask[i] = (i * 7) % 10 < 3;
+    std::vector<float> a(M * K), b(K * N), c(M * N), c_ref(M * N);
+    for (int i = 0; i < M * K; i++) a[i] = static_cast<float>((i * 7) % 11) / 16.0f - 0.3f;
+    for (int k = 0; k < K; k++) {
+        for (int n = 0; n < N; n++)
+            b[k * N + n] = block_mask[k / 16 * n_blocks + n / 16] ? static_cast<float>((k * N + n) % 13) / 16.0f - 0.4f : 0;
+    }
+    GemmDynMStaticParam param = {
+        dnnl_f32, dnnl_f32, dnnl_f32,
+        N, K, K * 4, N * 4, N * 4
+    };
+    if (pack)
+        param.b_sparse.b = b.data();
+    else
+        param.b_sparse.block_mask = block_mask.data();
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+    GemmDynMRuntimeParam rtParam = {
+        M, a.data(), pack ? nullptr : b.data(), c.data()
+    };
+    gemm(rtParam);
+
+    matmul_ref(a.data(), b.data(), c_ref.data(), M, N, K, K, N, N);
+    for (int i = 0; i < M * N; i++) {
+        ASSERT_NEAR(c[i], c_ref[i], 0.00001f * std::abs(c_ref[i]) + 0.00001f) << "first error at " << i;
+    }
+}
+
+const auto sparseBCase = ::testing::Combine(
+    Values(false, true),
+    Values(40, 100, 200),
+    Values(37, 256)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_GemmDriverSparseB, GemmDriverSparseBTest, sparseBCase, GemmDriverSparseBTest::getTestCaseName);
+
+using SkipZeroATestParamSet = std::tuple<
+        int,                                         // percent of zeros in A
+        int,                                         // M
+        int,                                         // N
+        int                                          // K
+        >;
+
+class GemmDriverSkipZeroATest : public TestWithParam<SkipZeroATestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<SkipZeroATestParamSet>& obj) {
+        int zero, M, N, K;
+        std::tie(zero, M, N, K) = obj.param;
+
+        std::ostringstream result;
+        result << "zero_" << zero << "_M_" << M << "_N_" << N << "_K_" << K;
+        return result.str();
+    }
+};
+
+TEST_P(GemmDriverSkipZeroATest, Func) {
+    auto [zero, M, N, K] = GetParam();
+    GemmDynMStaticParam param = {
+        dnnl_f32, dnnl_f32, dnnl_f32,
+        N, K, K * 4, N * 4, N * 4
+    };
+    param.skip_zero_a = true;
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+
+    std::vector<float> a(M * K), b(K * N), c(M * N), c_ref(M * N);
+    for (int i = 0; i < M * K; i++)
+        a[i] = (i * 37) % 100 < zero ? 0 : static_cast<float>((i * 7) % 11) / 16.0f;
+    for (int i = 0; i < K * N; i++) b[i] = static_cast<float>((i * 5) % 13) / 16.0f - 0.4f;
+    GemmDynMRuntimeParam rtParam = {
+        M, a.data(), b.data(), c.data()
+    };
+    gemm(rtParam);
+
+    matmul_ref(a.data(), b.data(), c_ref.data(), M, N, K, K, N, N);
+    for (int i = 0; i < M * N; i++) {
+        ASSERT_NEAR(c[i], c_ref[i], 0.00001f * std::abs(c_ref[i]) + 0.00001f) << "first error at " << i;
+    }
+}
+
+const auto skipZeroACase = ::testing::Combine(
+    Values(0, 70, 95, 100),
+    Values(3, 256),
+    Values(40, 200),
+    Values(37, 256)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_GemmDriverSkipZeroA, GemmDriverSkipZeroATest, skipZeroACase, GemmDriverSkipZeroATest::getTestCaseName);
+
+using QuantTestParamSet = std::tuple<
+        int,                                         // M
+        int,                                         // N
+        int                                          // K
+        >;
+
+class GemmDriverQuantTest : public TestWithParam<QuantTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<QuantTestParamSet>& obj) {
+        int M, N, K;
+        std::tie(M, N, K) = obj.param;
+
+        std::ostringstream result;
+        result << "M_" << M << "_N_" << N << "_K_" << K;
+        return result.str();
+    }
+};
+
+TEST_P(GemmDriverQuantTest, Func) {
+    auto [M, N, K] = GetParam();
+    std::vector<float> a(M * K), c(M * N), c_ref(M * N), b_scale(N), bias(N);
+    std::vector<int8_t> b(N * K);
+    for (int i = 0; i < M * K; i++) a[i] = static_cast<float>((i * 7) % 23) / 8.0f - 1.4f;
+    // an all zero row
+    for (int i = 0; i < K; i++) a[i] = 0;
+    for (int i = 0; i < N * K; i++) b[i] = static_cast<int8_t>((i * 37) % 255 - 127);
+    for (int i = 0; i < N; i++) {
+        b_scale[i] = static_cast<float>(i % 7 + 1) / 512.0f;
+        bias[i] = static_cast<float>(i % 9) - 4.0f;
+    }
+    GemmDynMStaticParam param = {
+        dnnl_f32, dnnl_s8, dnnl_f32,
+        N, K, K * 4, K, N * 4
+    };
+    param.quant.b = b.data();
+    param.quant.b_scale = b_scale.data();
+    PostOpStaticParams& post_ops = param.post_static_params;
+    post_ops.num = 1;
+    post_ops.ops[0].alg_type = AlgType::Add;
+    post_ops.ops[0].binary_param.layout = BinaryDataLayout::PerChannel;
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+
+    GemmDynMRuntimeParam rtParam = {
+        M, a.data(), nullptr, c.data()
+    };
+    rtParam.post_runtime_params.params[0].right_addr = bias.data();
+    gemm(rtParam);
+
+    for (int m = 0; m < M; m++) {
+        const float* x = &a[m * K];
+        float absmax = 0;
+        for (int k = 0; k < K; k++)
+            absmax = std::max(absmax, std::abs(x[k]));
+        float scale = absmax * (1.0f / 127);
+        float inv = 127.0f / std::max(absmax, 1e-30f);
+        for (int n = 0; n < N; n++) {
+            int sum = 0;
+            for (int k = 0; k < K; k++)
+                sum += static_cast<int>(std::nearbyint(x[k] * inv)) * b[n * K + k];
+            c_ref[m * N + n] = static_cast<float>(sum) * scale * b_scale[n] + bias[n];
+        }
+    }
+    for (int i = 0; i < M * N; i++) {
+        ASSERT_NEAR(c[i], c_ref[i], 0.00001f * std::abs(c_ref[i]) + 0.00001f) << "first error at " << i;
+    }
+}
+
+const auto quantCase = ::testing::Combine(
+    Values(1, 7, 256),
+    Values(16, 40, 200),
+    Values(13, 64, 259)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_GemmDriverQuant, GemmDriverQuantTest, quantCase, GemmDriverQuantTest::getTestCaseName);
+
+// dense f32 problem of the driver tests with fixed fills of A and B; accumulate starts C from c0 and adds
+// it back through a PerElement Add post op, so a block that is skipped or computed twice shows up in C
+struct DenseCase {
+    int M, N, K;
+    bool accumulate;
+    std::vector<float> a, b, c, c0, c_ref;
+
+    DenseCase(int M, int N, int K, bool accumulate = false) :
+        M(M), N(N), K(K), accumulate(accumulate), a(M * K), b(K * N), c(M * N), c0(M * N), c_ref(M * N) {
+        for (int i = 0; i < M * K; i++) a[i] = static_cast<float>((i * 7) % 11) / 16.0f - 0.3f;
+        for (int i = 0; i < K * N; i++) b[i] = static_cast<float>((i * 5) % 13) / 16.0f - 0.4f;
+        for (int i = 0; i < M * N; i++) c0[i] = static_cast<float>(i % 17) - 8.0f;
+    }
+
+    GemmDynMStaticParam static_param() const {
+        GemmDynMStaticParam param = {
+            dnnl_f32, dnnl_f32, dnnl_f32,
+            N, K, K * 4, N * 4, N * 4
+        };
+        if (accumulate) {
+            PostOpStaticParams& post_ops = param.post_static_params;
+            post_ops.num = 1;
+            post_ops.ops[0].alg_type = AlgType::Add;
+            post_ops.ops[0].binary_param.layout = BinaryDataLayout::PerElement;
+        }
+        return param;
+    }
+
+    // the first m rows, b_run: B of the call when it is not b
+    GemmDynMRuntimeParam runtime_param(int m, float* b_run = nullptr) {
+        if (accumulate)
+            std::copy(c0.begin(), c0.begin() + m * N, c.begin());
+        GemmDynMRuntimeParam param = {
+            m, a.data(), b_run ? b_run : b.data(), c.data()
+        };
+        if (accumulate)
+            param.post_runtime_params.params[0].right_addr = c.data();
+        return param;
+    }
+
+    void check(int m, float abs_err = 0.0001f, float* b_ref = nullptr) {
+        matmul_ref(a.data(), b_ref ? b_ref : b.data(), c_ref.data(), m, N, K, K, N, N);
+        for (int i = 0; i < m * N; i++) {
+            float ref = c_ref[i] + (accumulate ? c0[i] : 0);
+            ASSERT_NEAR(c[i], ref, 0.00001f * std::abs(ref) + abs_err) << "first error at " << i << " of M " << m;
+        }
+    }
+};
+
+using BlockingTestParamSet = std::tuple<
+        int,                                         // ur_num, -1 means autotune
+        int,                                         // m_group
+        int,                                         // N_block
+        int                                          // N
+        >;
+
+class GemmDriverBlockingTest : public TestWithParam<BlockingTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<BlockingTestParamSet>& obj) {
+        int ur_num, m_group, N_block, N;
+        std::tie(ur_num, m_group, N_block, N) = obj.param;
+
+        std::ostringstream result;
+        result << "ur_" << (ur_num < 0 ? std::string("auto") : std::to_string(ur_num)) << "_group_" << m_group
+               << "_N_block_" << N_block << "_N_" << N;
+        return result.str();
+    }
+};
+
+TEST_P(GemmDriverBlockingTest, Func) {
+    auto [ur_num, m_group, N_block, N] = GetParam();
+    const int M = 123, K = 67;
+    DenseCase dense(M, N, K);
+    auto param = dense.static_param();
+    if (ur_num < 0) {
+        param.blocking.autotune = true;
+        param.blocking.tune_m[0] = 16;
+        param.blocking.tune_m[1] = 64;
+    } else {
+        param.blocking.ur_num = ur_num;
+        param.blocking.m_group = m_group;
+        param.blocking.N_block = N_block;
+    }
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+
+    gemm(dense.runtime_param(M));
+    dense.check(M, 0.00001f);
+}
+
+const auto blockingCase = Values(
+    std::make_tuple(4, 1, 16, 100),
+    std::make_tuple(14, 2, 32, 100),
+    std::make_tuple(9, 4, 48, 200),
+    std::make_tuple(3, 16, 64, 200),
+    std::make_tuple(29, 1, 0, 13),
+    std::make_tuple(-1, 0, 0, 100)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_GemmDriverBlocking, GemmDriverBlockingTest, blockingCase, GemmDriverBlockingTest::getTestCaseName);
+
+using HotMTestParamSet = std::tuple<
+        int,                                         // M
+        int                                          // N
+        >;
+
+class GemmDriverHotMTest : public TestWithParam<HotMTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<HotMTestParamSet>& obj) {
+        int M, N;
+        std::tie(M, N) = obj.param;
+
+        std::ostringstream result;
+        result << "M_" << M << "_N_" << N;
+        return result.str();
+    }
+};
+
+TEST_P(GemmDriverHotMTest, Func) {
+    auto [M, N] = GetParam();
+    const int K = 67;
+    DenseCase dense(M, N, K);
+    auto param = dense.static_param();
+    int hot_m[] = {1, 8, 32, 130};
+    std::copy(std::begin(hot_m), std::end(hot_m), param.hot_m);
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+    // init already planned the hot M values
+    if (std::find(std::begin(hot_m), std::end(hot_m), M) != std::end(hot_m)) {
+        ASSERT_TRUE(get_exec_info(gemm, M).cached);
+    }
+
+    gemm(dense.runtime_param(M));
+    dense.check(M, 0.00001f);
+}
+
+const auto hotMCase = ::testing::Combine(
+    Values(1, 8, 32, 130, 77),
+    Values(40, 200)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_GemmDriverHotM, GemmDriverHotMTest, hotMCase, GemmDriverHotMTest::getTestCaseName);
+
+using PrefetchTestParamSet = std::tuple<
+        int,                                         // a_dist
+        int,                                         // b_dist
+        int,                                         // c
+        int                                          // K
+        >;
+
+class GemmDriverPrefetchTest : public TestWithParam<PrefetchTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<PrefetchTestParamSet>& obj) {
+        int a_dist, b_dist, c, K;
+        std::tie(a_dist, b_dist, c, K) = obj.param;
+
+        std::ostringstream result;
+        result << "a_" << a_dist << "_b_" << b_dist << "_c_" << c << "_K_" << K;
+        return result.str();
+    }
+};
+
+TEST_P(GemmDriverPrefetchTest, Func) {
+    auto [a_dist, b_dist, prefetch_c, K] = GetParam();
+    const int M = 77, N = 100;
+    DenseCase dense(M, N, K);
+    auto param = dense.static_param();
+    param.prefetch.a_dist = a_dist;
+    param.prefetch.b_dist = b_dist;
+    param.prefetch.c = prefetch_c;
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+    // explicit distances are taken as they are, negative ones turn the prefetch off
+    auto prefetch = get_prefetch(param);
+    if (a_dist) {
+        EXPECT_EQ(prefetch.a_dist, std::max(a_dist, 0));
+    }
+    if (b_dist) {
+        EXPECT_EQ(prefetch.b_dist, std::max(b_dist, 0));
+    }
+    if (prefetch_c) {
+        EXPECT_EQ(prefetch.c, prefetch_c > 0 ? 1 : 0);
+    }
+
+    gemm(dense.runtime_param(M));
+    dense.check(M);
+}
+
+const auto prefetchCase = Values(
+    std::make_tuple(0, 0, 0, 1030),
+    std::make_tuple(2, 1, 1, 300),
+    std::make_tuple(8, 4, 1, 1030),
+    std::make_tuple(-1, -1, -1, 1030)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_GemmDriverPrefetch, GemmDriverPrefetchTest, prefetchCase, GemmDriverPrefetchTest::getTestCaseName);
+
+using NumaTestParamSet = std::tuple<
+        int,                                         // M
+        bool,                                        // runtime b is the replicated one
+        bool,                                        // two unbound arenas instead of the nodes of the machine
+        GemmSchedule                                 // kind
+        >;
+
+class GemmDriverNumaTest : public TestWithParam<NumaTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<NumaTestParamSet>& obj) {
+        int M;
+        bool same_b, arenas;
+        GemmSchedule kind;
+        std::tie(M, same_b, arenas, kind) = obj.param;
+
+        std::ostringstream result;
+        result << "M_" << M << "_same_b_" << same_b << "_arenas_" << arenas << "_kind_" << static_cast<int>(kind);
+        return result.str();
+    }
+};
+
+TEST_P(GemmDriverNumaTest, Func) {
+    auto [M, same_b, arenas, kind] = GetParam();
+    const int N = 100, K = 67;
+    // every block adds its product to C once, a block run by two nodes or by none shows up
+    DenseCase dense(M, N, K, true);
+    std::vector<float> b2(K * N);
+    for (int i = 0; i < K * N; i++) b2[i] = static_cast<float>((i * 3) % 7) / 8.0f - 0.2f;
+    auto param = dense.static_param();
+    param.numa.replicate_b = true;
+    param.numa.b = dense.b.data();
+    const int nodes[] = {-1, -1};
+    if (arenas) {
+        param.numa.nodes = nodes;
+        param.numa.node_num = 2;
+        // the arenas only run calls that use every thread
+        param.schedule.all_threads = true;
+    }
+    param.schedule.kind = kind;
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+    if (arenas) {
+        auto numa_nodes = get_exec_info(gemm, M).numa_nodes;
+        if (numa_nodes == 0)
+            GTEST_SKIP() << "B replication needs the TBB runtime";
+        ASSERT_EQ(numa_nodes, 2);
+    }
+
+    auto b_run = same_b ? dense.b.data() : b2.data();
+    gemm(dense.runtime_param(M, b_run));
+    dense.check(M, 0.0001f, b_run);
+}
+
+const auto numaCase = ::testing::Combine(
+    Values(1, 77, 1000),
+    Values(true, false),
+    Values(false, true),
+    Values(GemmSchedule::Static, GemmSchedule::Dynamic)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_GemmDriverNuma, GemmDriverNumaTest, numaCase, GemmDriverNumaTest::getTestCaseName);
+
+using ContextTestParamSet = std::tuple<
+        int,                                         // nthread
+        bool,                                        // pin to cpu 0
+        bool                                         // context per call instead of per matmul
+        >;
+
+class GemmDriverContextTest : public TestWithParam<ContextTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<ContextTestParamSet>& obj) {
+        int nthread;
+        bool pin, per_call;
+        std::tie(nthread, pin, per_call) = obj.param;
+
+        std::ostringstream result;
+        result << "nthread_" << nthread << "_pin_" << pin << "_per_call_" << per_call;
+        return result.str();
+    }
+};
+
+TEST_P(GemmDriverContextTest, Func) {
+    auto [nthread, pin, per_call] = GetParam();
+    const int M = 300, N = 100, K = 67;
+    const int cpus[] = {0};
+    ExecContextParam context_param;
+    context_param.nthread = nthread;
+    if (pin) {
+        context_param.cpu_num = 1;
+        context_param.cpus = cpus;
+    }
+    exec_context context;
+    bool ok = context.init(context_param);
+    if (!ok && pin)
+        GTEST_SKIP() << "pinning is not supported by this runtime";
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(context.nthread(), nthread);
+
+    DenseCase dense(M, N, K);
+    auto param = dense.static_param();
+    if (!per_call)
+        param.context = &context;
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+
+    auto rtParam = dense.runtime_param(M);
+    if (per_call)
+        rtParam.context = &context;
+    gemm(rtParam);
+    dense.check(M);
+}
+
+const auto contextCase = ::testing::Combine(
+    Values(1, 2),
+    Values(false, true),
+    Values(false, true)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_GemmDriverContext, GemmDriverContextTest, contextCase, GemmDriverContextTest::getTestCaseName);
+
+#ifdef __linux__
+// the caller enters both arenas, leaving the inner one must not keep it pinned after the outer one
+TEST(GemmDriverNestedContextTest, Func) {
+    const int cpus[] = {0};
+    ExecContextParam context_param;
+    context_param.nthread = 1;
+    context_param.cpu_num = 1;
+    context_param.cpus = cpus;
+    exec_context outer, inner;
+    if (!outer.init(context_param))
+        GTEST_SKIP() << "pinning is not supported by this runtime";
+    ASSERT_TRUE(inner.init(context_param));
+
+    cpu_set_t before, after;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(cpu_set_t), &before), 0);
+    outer.execute([&] {
+        inner.execute([] {});
+    });
+    ASSERT_EQ(sched_getaffinity(0, sizeof(cpu_set_t), &after), 0);
+    ASSERT_TRUE(CPU_EQUAL(&before, &after));
+}
+#endif
+
+// runs every closure on its own thread and joins them before returning
+struct test_threadpool : public dnnl::threadpool_interop::threadpool_iface {
+    int get_num_threads() const override {
+        return 4;
+    }
+    bool get_in_parallel() const override {
+        return in_parallel;
+    }
+    void parallel_for(int n, const std::function<void(int, int)>& fn) override {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < n; i++)
+            threads.emplace_back([&, i] {
+                in_parallel = true;
+                fn(i, n);
+            });
+        for (auto& t : threads)
+            t.join();
+    }
+    uint64_t get_flags() const override {
+        return 0;
+    }
+    static thread_local bool in_parallel;
+};
+thread_local bool test_threadpool::in_parallel = false;
+
+TEST(GemmDriverThreadpoolTest, Func) {
+    const int M = 300, N = 100, K = 67;
+    test_threadpool tp;
+    set_threadpool(&tp);
+    DenseCase dense(M, N, K);
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(dense.static_param()));
+
+    gemm(dense.runtime_param(M));
+    set_threadpool(nullptr);
+    dense.check(M);
+}
+
+using ScheduleTestParamSet = std::tuple<
+        GemmSchedule,                                // kind
+        int,                                         // M
+        int                                          // chunk
+        >;
+
+class GemmDriverScheduleTest : public TestWithParam<ScheduleTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<ScheduleTestParamSet>& obj) {
+        GemmSchedule kind;
+        int M, chunk;
+        std::tie(kind, M, chunk) = obj.param;
+
+        std::ostringstream result;
+        result << "kind_" << static_cast<int>(kind) << "_M_" << M << "_chunk_" << chunk;
+        return result.str();
+    }
+};
+
+TEST_P(GemmDriverScheduleTest, Func) {
+    auto [kind, M, chunk] = GetParam();
+    const int N = 200, K = 67;
+    // every block adds its product to C once, a block grabbed twice or never shows up
+    DenseCase dense(M, N, K, true);
+    auto param = dense.static_param();
+    param.schedule.kind = kind;
+    param.schedule.chunk = chunk;
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+    if (kind != GemmSchedule::Auto) {
+        ASSERT_EQ(get_exec_info(gemm, M).dynamic, kind == GemmSchedule::Dynamic);
+    }
+
+    gemm(dense.runtime_param(M));
+    dense.check(M);
+}
+
+const auto scheduleCase = ::testing::Combine(
+    Values(GemmSchedule::Static, GemmSchedule::Dynamic, GemmSchedule::Auto),
+    Values(1, 77, 1000),
+    Values(0, 3, 100)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_GemmDriverSchedule, GemmDriverScheduleTest, scheduleCase, GemmDriverScheduleTest::getTestCaseName);
+
+using ThreadsTestParamSet = std::tuple<
+        int,                                         // M
+        int,                                         // N
+        bool                                         // all threads
+        >;
+
+class GemmDriverThreadsTest : public TestWithParam<ThreadsTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<ThreadsTestParamSet>& obj) {
+        int M, N;
+        bool all_threads;
+        std::tie(M, N, all_threads) = obj.param;
+
+        std::ostringstream result;
+        result << "M_" << M << "_N_" << N << "_all_threads_" << all_threads;
+        return result.str();
+    }
+};
+
+TEST_P(GemmDriverThreadsTest, Func) {
+    auto [M, N, all_threads] = GetParam();
+    const int K = 64;
+    DenseCase dense(M, N, K);
+    auto param = dense.static_param();
+    param.schedule.all_threads = all_threads;
+    param.hot_m[0] = M;
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+    auto info = get_exec_info(gemm, M);
+    ASSERT_GE(info.nthread, 1);
+    ASSERT_LE(info.nthread, info.nthread_max);
+    if (all_threads) {
+        ASSERT_EQ(info.nthread, info.nthread_max);
+    } else {
+        // one M block of at most 8 rows and one N block: nothing to split
+        if (M <= 8 && N <= 64) {
+            ASSERT_EQ(info.nthread, 1);
+        }
+        // more rows never take fewer threads
+        ASSERT_GE(get_exec_info(gemm, M * 16).nthread, info.nthread);
+    }
+
+    gemm(dense.runtime_param(M));
+    dense.check(M);
+}
+
+const auto threadsCase = ::testing::Combine(
+    Values(1, 4, 33, 512),
+    Values(16, 100),
+    Values(false, true)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_GemmDriverThreads, GemmDriverThreadsTest, threadsCase, GemmDriverThreadsTest::getTestCaseName);
+
+TEST(GemmDriverPlanTest, Func) {
+    const int N = 100, K = 67, max_M = 600;
+    DenseCase dense(max_M, N, K);
+    auto param = dense.static_param();
+    param.hot_m[0] = 64;
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+
+    // the second round runs on the cached plans
+    for (int round = 0; round < 2; round++) {
+        for (int M = 1; M <= max_M; M += 1 + M / 4) {
+            gemm(dense.runtime_param(M));
+            ASSERT_NO_FATAL_FAILURE(dense.check(M));
+        }
+    }
+    for (int M = 1; M <= max_M; M += 1 + M / 4)
+        ASSERT_TRUE(get_exec_info(gemm, M).cached) << "M " << M;
+}
+
+// multiples of 256 share the low bits of their hash, they must still spread over the table
+TEST(GemmDriverPlanTest, Multiples) {
+    const int N = 16, K = 16, M_num = 12;
+    DenseCase dense(256 * M_num, N, K);
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(dense.static_param()));
+
+    for (int i = 1; i <= M_num; i++) {
+        gemm(dense.runtime_param(256 * i));
+        ASSERT_NO_FATAL_FAILURE(dense.check(256 * i));
+    }
+    for (int i = 1; i <= M_num; i++)
+        ASSERT_TRUE(get_exec_info(gemm, 256 * i).cached) << "M " << 256 * i;
+}
+
+// a second init replaces the kernels, plans and B copies of the first one
+TEST(GemmDriverReinitTest, Func) {
+    const int K = 67, M = 77;
+    DenseCase sparse(M, 100, K), dense(M, 40, K, true);
+    auto sparse_param = sparse.static_param();
+    // every block is marked non zero, so the result is the dense product
+    std::vector<uint8_t> block_mask(((K + 15) / 16) * ((sparse.N + 15) / 16), 1);
+    sparse_param.b_sparse.block_mask = block_mask.data();
+    auto dense_param = dense.static_param();
+    dense_param.hot_m[0] = M;
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(sparse_param));
+    gemm(sparse.runtime_param(M));
+    ASSERT_NO_FATAL_FAILURE(sparse.check(M));
+
+    ASSERT_TRUE(gemm.init(dense_param));
+    gemm(dense.runtime_param(M));
+    ASSERT_NO_FATAL_FAILURE(dense.check(M));
+    gemm(dense.runtime_param(M - 1));
+    ASSERT_NO_FATAL_FAILURE(dense.check(M - 1));
+
+    ASSERT_TRUE(gemm.init(sparse.static_param()));
+    ASSERT_FALSE(get_exec_info(gemm, M - 1).cached);
+    gemm(sparse.runtime_param(M));
+    ASSERT_NO_FATAL_FAILURE(sparse.check(M));
+}
+
+TEST(GemmDriverConcurrentTest, Func) {
+    const int N = 200, K = 67, caller_num = 4;
+    GemmDynMStaticParam param = {
+        dnnl_f32, dnnl_f32, dnnl_f32,
+        N, K, K * 4, N * 4, N * 4
+    };
+    // several N blocks, so every call needs its own partial sums
+    param.row_reduce.alg = RowReduceAlg::Sum;
+    matmul gemm;
+    ASSERT_TRUE(gemm.init(param));
+
+    std::vector<float> b(K * N);
+    for (int i = 0; i < K * N; i++) b[i] = static_cast<float>((i * 5) % 13) / 16.0f - 0.4f;
+    std::vector<int> errors(caller_num);
+    std::vector<std::thread> callers;
+    for (int t = 0; t < caller_num; t++) {
+        callers.emplace_back([&, t] {
+            int M = 37 + t * 61;
+            std::vector<float> a(M * K), c(M * N), c_ref(M * N), sum(M);
+            for (int i = 0; i < M * K; i++) a[i] = static_cast<float>((i * 7 + t) % 11) / 16.0f - 0.3f;
+            matmul_ref(a.data(), b.data(), c_ref.data(), M, N, K, K, N, N);
+            for (int round = 0; round < 20; round++) {
+                GemmDynMRuntimeParam rtParam = {
+                    M, a.data(), b.data(), c.data()
+                };
+                rtParam.post_runtime_params.row_reduce_val = sum.data();
+                gemm(rtParam);
+                for (int m = 0; m < M; m++) {
+                    float sum_ref = 0;
+                    for (int n = 0; n < N; n++) {
+                        sum_ref += c_ref[m * N + n];
+                        if (std::abs(c[m * N + n] - c_ref[m * N + n]) > 0.00001f * std::abs(c_ref[m * N + n]) + 0.0001f)
+                            errors[t]++;
+                    }
+                    if (std::abs(sum[m] - sum_ref) > 0.0001f * std::abs(sum_ref) + 0.001f)
+                        errors[t]++;
+                }
+            }
+        });
+    }
+    for (auto& caller : callers)
+        caller.join();
+    for (int t = 0; t < caller_num; t++)
+        ASSERT_EQ(errors[t], 0) << "caller " << t;
+}
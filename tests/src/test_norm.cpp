@@ -0,0 +1,90 @@
+#include <cstdio>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include <cmath>
+#include "gtest/gtest.h"
+#include "boat.h"
+
+using namespace std;
+using namespace boat;
+using ::testing::TestWithParam;
+using ::testing::Values;
+using ::testing::ValuesIn;
+
+using NormTestParamSet = std::tuple<
+        RowNormAlg,                                  // alg
+        int                                          // N
+        >;
+
+class NormTest : public TestWithParam<NormTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<NormTestParamSet>& obj) {
+        RowNormAlg alg;
+        int N;
+        std::tie(alg, N) = obj.param;
+
+        std::ostringstream result;
+        result << "alg_" << static_cast<int>(alg) << "_N_" << N;
+        return result.str();
+    }
+};
+
+TEST_P(NormTest, Func) {
+    auto [alg, N] = GetParam();
+    const int M = 37, ld = N + 3;
+    NormStaticParam param = {
+        dnnl_f32, alg, N, ld * 4, N * 4
+    };
+    norm op;
+    ASSERT_TRUE(op.init(param));
+
+    std::vector<float> src(M * ld), dst(M * N), dst_ref(M * N), gamma(N), beta(N);
+    for (int i = 0; i < M * ld; i++) src[i] = static_cast<float>((i * 7) % 23) / 4.0f - 2.5f;
+    for (int i = 0; i < N; i++) {
+        gamma[i] = static_cast<float>(i % 5) / 4.0f + 0.5f;
+        beta[i] = static_cast<float>(i % 7) / 8.0f - 0.25f;
+    }
+    NormRuntimeParam rtParam = {
+        M, src.data(), dst.data(), gamma.data(), beta.data()
+    };
+    op(rtParam);
+
+    for (int m = 0; m < M; m++) {
+        const float* x = &src[m * ld];
+        float* y = &dst_ref[m * N];
+        if (alg == RowNormAlg::Softmax || alg == RowNormAlg::LogSoftmax) {
+            float max = *std::max_element(x, x + N), sum = 0;
+            for (int n = 0; n < N; n++)
+                sum += std::exp(x[n] - max);
+            for (int n = 0; n < N; n++)
+                y[n] = alg == RowNormAlg::Softmax ? std::exp(x[n] - max) / sum : x[n] - max - std::log(sum);
+        } else {
+            double mean = 0, var = 0;
+            for (int n = 0; n < N; n++)
+                mean += x[n];
+            mean /= N;
+            for (int n = 0; n < N; n++)
+                var += alg == RowNormAlg::LayerNorm ? (x[n] - mean) * (x[n] - mean) : x[n] * x[n];
+            var /= N;
+            float inv_std = static_cast<float>(1.0 / std::sqrt(var + param.eps));
+            for (int n = 0; n < N; n++) {
+                if (alg == RowNormAlg::LayerNorm)
+                    y[n] = (x[n] - static_cast<float>(mean)) * inv_std * gamma[n] + beta[n];
+                else
+                    y[n] = x[n] * inv_std * gamma[n];
+            }
+        }
+    }
+    for (int i = 0; i < M * N; i++) {
+        ASSERT_NEAR(dst[i], dst_ref[i], 0.0001f * std::abs(dst_ref[i]) + 0.00001f) << "first error at " << i;
+    }
+}
+
+const auto normCase = ::testing::Combine(
+    Values(RowNormAlg::Softmax, RowNormAlg::LogSoftmax, RowNormAlg::LayerNorm, RowNormAlg::RMSNorm),
+    Values(13, 64, 100, 1000)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_Norm, NormTest, normCase, NormTest::getTestCaseName);
@@ -0,0 +1,71 @@
+#include <cstdio>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include "gtest/gtest.h"
+#include "boat.h"
+
+using namespace std;
+using namespace boat;
+using ::testing::TestWithParam;
+using ::testing::Values;
+using ::testing::ValuesIn;
+
+using TransposeTestParamSet = std::tuple<
+        int,                                         // elem_size
+        int,                                         // rows
+        int                                          // cols
+        >;
+
+class TransposeTest : public TestWithParam<TransposeTestParamSet> {
+public:
+    static std::string getTestCaseName(const testing::TestParamInfo<TransposeTestParamSet>& obj) {
+        int elem_size, rows, cols;
+        std::tie(elem_size, rows, cols) = obj.param;
+
+        std::ostringstream result;
+        result << "elem_" << elem_size << "_rows_" << rows << "_cols_" << cols;
+        return result.str();
+    }
+};
+
+TEST_P(TransposeTest, Func) {
+    auto [elem_size, rows, cols] = GetParam();
+    int group = 4 / elem_size;
+    // padded strides, dst keeps a canary column after rows
+    int ld_src = (cols + 8) * elem_size;
+    int ld_dst = (rows + 4) * 4;
+    int dst_rows = cols / group;
+    TransposeStaticParam param = {
+        elem_size, group, cols, ld_src, ld_dst
+    };
+    transpose op;
+    ASSERT_TRUE(op.init(param));
+
+    std::vector<uint8_t> src(rows * ld_src), dst(dst_rows * ld_dst, 0xcd), dst_ref(dst_rows * ld_dst, 0xcd);
+    for (size_t i = 0; i < src.size(); i++) src[i] = static_cast<uint8_t>(i * 7 + i / 251);
+    TransposeRuntimeParam rtParam = {
+        rows, src.data(), dst.data()
+    };
+    op(rtParam);
+
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            memcpy(&dst_ref[(c / group) * ld_dst + r * 4 + (c % group) * elem_size], &src[r * ld_src + c * elem_size], elem_size);
+        }
+    }
+    for (size_t i = 0; i < dst.size(); i++) {
+        ASSERT_EQ(dst[i], dst_ref[i]) << "first error at " << i;
+    }
+}
+
+const auto transposeCase = ::testing::Combine(
+    Values(4, 2, 1),
+    Values(1, 16, 37, 400),
+    Values(4, 16, 36, 64, 200)
+);
+INSTANTIATE_TEST_SUITE_P(smoke_Transpose, TransposeTest, transposeCase, TransposeTest::getTestCaseName);